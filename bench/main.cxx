@@ -0,0 +1,731 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3
+// For more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <address_spv.hxx>
+#include <chrono>
+#include <compute_spv.hxx>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vkmincomp.hxx>
+
+#define WIDTH 128
+
+using namespace std;
+using namespace vkmincomp;
+
+/* the engine copy insizes bytes from the storage of each vector, so the
+ * vector is only a byte container here
+ */
+static vector<vector<void *>> makeIO(uint32_t elems = WIDTH) {
+  vector<vector<void *>> io(1);
+  io[0].resize(elems * sizeof(float) / sizeof(void *) + 1);
+  float *data = reinterpret_cast<float *>(io[0].data());
+  for (uint32_t i = 0; i < elems; ++i)
+    data[i] = float(i);
+  return io;
+}
+
+static void setupEngine(stdEng *eng, vector<vector<void *>> &inputs,
+                        vector<vector<void *>> &outputs,
+                        uint32_t elems = WIDTH) {
+  eng->setInputs(inputs, {elems * sizeof(float)});
+  eng->setOutputs(outputs, {elems * sizeof(float)});
+  eng->setBindings({2});
+  eng->setShaderCode(computeSpv);
+  eng->setEntryPoint("main");
+  eng->setLocalSize(64);
+  eng->setElementCount(elems);
+}
+
+// one row of the machine readable output, bytes is 0 when there is no size
+struct benchResult {
+  string name;
+  size_t bytes;
+  double value;
+  string unit;
+};
+static vector<benchResult> results;
+
+static void report(const string &name, size_t bytes, double value,
+                   const string &unit) {
+  results.push_back({name, bytes, value, unit});
+}
+
+// a JSON string literal: quotes, backslashes and control characters escaped
+static string jsonString(const string &text) {
+  string out = "\"";
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += char(c);
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else
+      out += char(c);
+  }
+  return out + '"';
+}
+
+static bool writeJson(const char *path, const string &device,
+                      uint32_t iters) {
+  ofstream out(path);
+  out << "{\"device\": " << jsonString(device) << ", \"iterations\": "
+      << iters << ", \"results\": [";
+  for (size_t i = 0; i < results.size(); ++i)
+    out << (i ? "," : "") << "\n  {\"name\": " << jsonString(results[i].name)
+        << ", \"bytes\": " << results[i].bytes
+        << ", \"value\": " << results[i].value
+        << ", \"unit\": " << jsonString(results[i].unit) << "}";
+  out << "\n]}\n";
+  return bool(out);
+}
+
+static bool writeCsv(const char *path) {
+  ofstream out(path);
+  out << "name,bytes,value,unit\n";
+  for (benchResult &res : results)
+    out << res.name << "," << res.bytes << "," << res.value << ","
+        << res.unit << "\n";
+  return bool(out);
+}
+
+static double usSince(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, micro>(chrono::steady_clock::now() - start)
+      .count();
+}
+
+// old path: every job pays instance, device, pipeline and everything else
+static double benchRebuild(uint32_t iters) {
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  auto start = chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iters; ++i) {
+    stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+    setupEngine(eng, inputs, outputs);
+    eng->run();
+    delete eng;
+  }
+  return usSince(start) / iters;
+}
+
+/* instance creation, the constructor, and logical device creation, the
+ * createDevice step of build()
+ */
+static void benchStartup(uint32_t iters, double &instanceUs,
+                         double &deviceUs, string &device) {
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  instanceUs = deviceUs = 0;
+  for (uint32_t i = 0; i < iters; ++i) {
+    auto start = chrono::steady_clock::now();
+    stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+    instanceUs += usSince(start);
+    setupEngine(eng, inputs, outputs);
+    eng->build();
+    for (auto &phase : eng->getProfileStats().buildPhases)
+      if (phase.first == "createDevice")
+        deviceUs += phase.second / 1000.0;
+    device = eng->getDeviceName();
+    delete eng;
+  }
+  instanceUs /= iters;
+  deviceUs /= iters;
+}
+
+/* engines made and built one after another, each with an instance and a
+ * device of its own and then all on one sharedContext, the time per engine
+ */
+static void benchSharedContext(uint32_t engines, double &ownUs,
+                               double &sharedUs) {
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  vector<stdEng *> engs;
+  auto start = chrono::steady_clock::now();
+  for (uint32_t i = 0; i < engines; ++i) {
+    engs.push_back(new stdEng("bench", 1, "vkmincomp", 1));
+    setupEngine(engs.back(), inputs, outputs);
+    engs.back()->build();
+  }
+  ownUs = usSince(start) / engines;
+  for (stdEng *eng : engs)
+    delete eng;
+  engs.clear();
+
+  start = chrono::steady_clock::now();
+  sharedContext *ctx = sharedContext::acquire("bench", 1, "vkmincomp", 1);
+  for (uint32_t i = 0; i < engines; ++i) {
+    engs.push_back(new stdEng(ctx));
+    setupEngine(engs.back(), inputs, outputs);
+    engs.back()->build();
+  }
+  sharedUs = usSince(start) / engines;
+  ctx->release();
+  for (stdEng *eng : engs)
+    delete eng;
+}
+
+// the smallest dispatch there is, one element, submitted and waited for
+static double benchEmptyDispatch(uint32_t iters) {
+  vector<vector<void *>> inputs = makeIO(1), outputs = makeIO(1);
+  stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+  setupEngine(eng, inputs, outputs, 1);
+  eng->build();
+  eng->dispatch(); // warm up
+  auto start = chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iters; ++i)
+    eng->dispatch();
+  double us = usSince(start) / iters;
+  delete eng;
+  return us;
+}
+
+/* run() on buffers of bytes each: the first call, which builds, the calls
+ * after it, and the copy bandwidth both ways. Host to device is the copy of
+ * the inputs into mapped memory plus the gpu upload from staging, device to
+ * host the gpu download plus readOutput, the gpu parts are 0 on devices
+ * whose buffers the host maps directly.
+ */
+static void benchSize(size_t bytes, uint32_t iters) {
+  uint32_t elems = uint32_t(bytes / sizeof(float));
+  vector<vector<void *>> inputs = makeIO(elems), outputs = makeIO(elems);
+  vector<char> dst(bytes);
+  stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+  setupEngine(eng, inputs, outputs, elems);
+  eng->setProfiling(true);
+  auto start = chrono::steady_clock::now();
+  eng->run();
+  report("run_first", bytes, usSince(start), "us");
+  double readUs = 0;
+  start = chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iters; ++i)
+    eng->run();
+  report("run", bytes, usSince(start) / iters, "us");
+  for (uint32_t i = 0; i < iters; ++i) {
+    auto read = chrono::steady_clock::now();
+    eng->readOutput(0, dst.data(), bytes);
+    readUs += usSince(read);
+  }
+  profileStats prof = eng->getProfileStats();
+  double h2dNs = double(prof.fillNanoseconds) / prof.submissions +
+                 double(prof.uploadNanoseconds) /
+                     max<uint64_t>(prof.timedSubmissions, 1);
+  double d2hNs = readUs * 1000 / iters +
+                 double(prof.downloadNanoseconds) /
+                     max<uint64_t>(prof.timedSubmissions, 1);
+  report("host_to_device", bytes, bytes / max(h2dNs, 1.0), "GB/s");
+  report("device_to_host", bytes, bytes / max(d2hNs, 1.0), "GB/s");
+  delete eng;
+}
+
+/* prepared kernel: build once, only dispatch per job. With reuse the command
+ * buffers are recorded once too.
+ */
+static double benchDispatch(uint32_t iters, bool reuse, recordStats &rec) {
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+  setupEngine(eng, inputs, outputs);
+  eng->setCommandReuse(reuse);
+  eng->build();
+  eng->dispatch(); // warm up
+  auto start = chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iters; ++i)
+    eng->dispatch();
+  double us = usSince(start) / iters;
+  rec = eng->getRecordStats();
+  delete eng;
+  return us;
+}
+
+// the same dispatches with timestamps, to see where the time goes
+static profileStats benchProfile(uint32_t iters) {
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+  setupEngine(eng, inputs, outputs);
+  eng->setProfiling(true);
+  eng->build();
+  for (uint32_t i = 0; i < iters; ++i)
+    eng->dispatch();
+  profileStats stats = eng->getProfileStats();
+  delete eng;
+  return stats;
+}
+
+/* the same dispatch with the buffers reached through their device address,
+ * nothing is bound. address is false when the device does not have it.
+ */
+static double benchAddress(uint32_t iters, bool &address) {
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+  address = eng->supportsAddressMode();
+  if (!address) {
+    delete eng;
+    return 0;
+  }
+  setupEngine(eng, inputs, outputs);
+  eng->setShaderCode(addressSpv);
+  eng->setPushConstants(uint32_t(WIDTH));
+  eng->setAddressMode(true);
+  eng->build();
+  eng->dispatch(); // warm up
+  auto start = chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iters; ++i)
+    eng->dispatch();
+  double us = usSince(start) / iters;
+  delete eng;
+  return us;
+}
+
+/* submit() without waiting, the host fills the inputs of the next submission
+ * while the gpu runs the previous ones
+ */
+static double benchAsync(uint32_t iters, uint32_t frames, uint32_t &queues) {
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+  setupEngine(eng, inputs, outputs);
+  eng->setFramesInFlight(frames);
+  eng->setQueueCount(queues);
+  eng->build();
+  queues = eng->getQueueCount();
+  eng->dispatch(); // warm up
+  vector<submission> inFlight(frames);
+  auto start = chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iters; ++i) {
+    submission &oldest = inFlight[i % frames];
+    // read the outputs of the oldest submission before its frame is reused
+    if (oldest.valid())
+      eng->outputView<float>(oldest, 0);
+    bufView<float> in = eng->inputSpan<float>(0);
+    for (uint32_t j = 0; j < in.size(); ++j)
+      in[j] = float(i + j);
+    oldest = eng->submit();
+  }
+  for (submission &s : inFlight)
+    if (s.valid())
+      s.wait();
+  double us = usSince(start) / iters;
+  delete eng;
+  return us;
+}
+
+// a dataset far larger than the buffers, cut in chunks of the input size
+static streamStats benchStream(size_t bytes, uint32_t frames) {
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  vector<char> src(bytes, 1), dst(bytes);
+  stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+  setupEngine(eng, inputs, outputs);
+  eng->setFramesInFlight(frames);
+  eng->build();
+  streamStats stats =
+      eng->stream(src.data(), src.size(), dst.data(), dst.size());
+  delete eng;
+  return stats;
+}
+
+/* many small independent jobs, one dispatch and one submit per job against
+ * one command buffer and one submit for all of them
+ *
+ * @return jobs per second of the one at a time path, the batch in batchRate
+ */
+static double benchBatch(uint32_t jobs, double &batchRate,
+                         descCacheStats &desc) {
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  vector<vector<float>> jobIn(jobs, vector<float>(WIDTH, 1.0f));
+  vector<vector<float>> jobOut(jobs, vector<float>(WIDTH));
+  stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+  setupEngine(eng, inputs, outputs);
+  eng->build();
+
+  auto start = chrono::steady_clock::now();
+  for (uint32_t j = 0; j < jobs; ++j) {
+    bufView<float> in = eng->inputSpan<float>(0);
+    memcpy(in.data(), jobIn[j].data(), WIDTH * sizeof(float));
+    eng->dispatch();
+    eng->readOutput(0, jobOut[j].data(), WIDTH * sizeof(float));
+  }
+  double single = jobs / (usSince(start) / 1e6);
+
+  vector<vector<const void *>> batchIn(jobs);
+  vector<vector<void *>> batchOut(jobs);
+  for (uint32_t j = 0; j < jobs; ++j) {
+    batchIn[j] = {jobIn[j].data()};
+    batchOut[j] = {jobOut[j].data()};
+  }
+  // a smaller batch first, growing it recycles its descriptor sets
+  eng->runBatch(vector<vector<const void *>>(batchIn.begin(),
+                                             batchIn.begin() + jobs / 2 + 1),
+                vector<vector<void *>>(batchOut.begin(),
+                                       batchOut.begin() + jobs / 2 + 1));
+  eng->runBatch(batchIn, batchOut); // creates the batch buffers
+  batchRate = eng->runBatch(batchIn, batchOut).jobsPerSec;
+  desc = eng->getDescriptorStats();
+  delete eng;
+  return single;
+}
+
+/* two dependent stages and one independent one, in one command buffer
+ * against two engines chained through the host
+ */
+static double benchGraph(uint32_t iters, double &chainedUs) {
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  stdEng *first = new stdEng("bench", 1, "vkmincomp", 1);
+  stdEng *second = new stdEng("bench", 1, "vkmincomp", 1);
+  setupEngine(first, inputs, outputs);
+  setupEngine(second, inputs, outputs);
+  first->build();
+  second->build();
+  vector<float> mid(WIDTH);
+  auto start = chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iters; ++i) {
+    first->dispatch();
+    first->readOutput(0, mid.data(), WIDTH * sizeof(float));
+    memcpy(second->inputSpan<float>(0).data(), mid.data(),
+           WIDTH * sizeof(float));
+    second->dispatch();
+  }
+  chainedUs = usSince(start) / iters;
+  delete second;
+
+  double us;
+  {
+    DeviceSize size = WIDTH * sizeof(float);
+    kernelGraph graph(*first);
+    uint32_t in = graph.addBuffer(size, GraphBuffer::GRAPH_INPUT);
+    uint32_t tmp = graph.addBuffer(size, GraphBuffer::GRAPH_INTERMEDIATE);
+    uint32_t out = graph.addBuffer(size, GraphBuffer::GRAPH_OUTPUT);
+    uint32_t side = graph.addBuffer(size, GraphBuffer::GRAPH_OUTPUT);
+    // not specialized, the shader runs with a local size of 1
+    graph.addKernel(computeSpv, "main", {in}, {tmp}, WIDTH, 1, 1);
+    graph.addKernel(computeSpv, "main", {tmp}, {out}, WIDTH, 1, 1);
+    graph.addKernel(computeSpv, "main", {in}, {side}, WIDTH, 1, 1);
+    graph.build();
+    memcpy(graph.inputData(in), makeIO()[0].data(), size);
+    start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iters; ++i) {
+      graph.run();
+      graph.readOutput(out, mid.data(), size);
+    }
+    us = usSince(start) / iters;
+    cout << "\tgraph levels = " << graph.getLevelCount()
+         << ", barriers = " << graph.getBarrierCount() << endl;
+  }
+  delete first;
+  return us;
+}
+
+/* pipeline compile time with an empty cache directory and again with the file
+ * saved by the first engine
+ */
+static void benchPipelineCache(double &coldUs, double &warmUs) {
+  string dir =
+      (filesystem::temp_directory_path() / "vkmincomp_bench_cache").string();
+  filesystem::remove_all(dir);
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  for (double *us : {&coldUs, &warmUs}) {
+    stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+    setupEngine(eng, inputs, outputs);
+    eng->setPipelineCacheDir(dir.c_str());
+    eng->build();
+    *us = eng->getPipelineCompileTime() / 1000.0;
+    delete eng;
+  }
+  filesystem::remove_all(dir);
+}
+
+/* the same local size variants created one after another and on a thread
+ * pool, each by a fresh engine with an empty in memory pipeline cache
+ */
+static void benchPipelineBatch(double &serialUs, double &parallelUs,
+                               uint32_t &pipelines, uint32_t &threads) {
+  vector<kernelVariant> kernels;
+  for (uint32_t x = 8; x <= 128; x += 8) {
+    kernelVariant k;
+    k.localSize[0] = x;
+    k.localSize[1] = k.localSize[2] = 1;
+    kernels.push_back(k);
+  }
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  for (uint32_t pool : {1u, 0u}) {
+    stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+    setupEngine(eng, inputs, outputs);
+    eng->build();
+    pipelineBuildStats stats = eng->createPipelines(kernels, pool);
+    (pool == 1 ? serialUs : parallelUs) = stats.nanoseconds / 1000.0;
+    pipelines = stats.pipelines;
+    threads = stats.threads;
+    delete eng;
+  }
+}
+
+/* sweep the local size, then build a fresh engine without setLocalSize that
+ * should pick the stored result up
+ */
+static tuneEntry benchAutotune(bool &reused) {
+  string file =
+      (filesystem::temp_directory_path() / "vkmincomp_bench_tune.txt")
+          .string();
+  filesystem::remove(file);
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+  setupEngine(eng, inputs, outputs);
+  eng->setAutotuneFile(file.c_str());
+  tuneEntry best = eng->autotune();
+  delete eng;
+
+  eng = new stdEng("bench", 1, "vkmincomp", 1);
+  eng->setInputs(inputs, {WIDTH * sizeof(float)});
+  eng->setOutputs(outputs, {WIDTH * sizeof(float)});
+  eng->setBindings({2});
+  eng->setShaderCode(computeSpv);
+  eng->setEntryPoint("main");
+  eng->setElementCount(WIDTH);
+  eng->setAutotuneFile(file.c_str());
+  eng->build();
+  reused = eng->isAutotuned();
+  delete eng;
+  filesystem::remove(file);
+  return best;
+}
+
+/* one dispatch of 4M elements cut over two logical devices on the first
+ * physical device, the split settles on the measured throughput
+ */
+static splitStats benchSplit(uint32_t iters, vector<double> &weights) {
+  const uint32_t elems = 1u << 22;
+  splitEng split("bench", 1, "vkmincomp", 1, [&](stdEng &eng) {
+    // input 0 is fed by run(), the vectors only carry the sizes here
+    eng.setInputs(vector<vector<void *>>(1), {elems * sizeof(float)});
+    eng.setOutputs(vector<vector<void *>>(1), {elems * sizeof(float)});
+    eng.setBindings({2});
+    eng.setShaderCode(computeSpv);
+    eng.setEntryPoint("main");
+    eng.setLocalSize(64);
+  });
+  split.setDevices({0, 0});
+  split.setElementCount(elems);
+  vector<float> src(elems, 1.0f), dst(elems);
+  splitStats stats;
+  for (uint32_t i = 0; i < iters; ++i)
+    stats = split.run(src.data(), dst.data());
+  weights = split.getWeights();
+  return stats;
+}
+
+/* jobs per second of runConcurrent with that many host threads sharing one
+ * engine, each thread runs iters jobs
+ */
+static double benchThreads(uint32_t iters, uint32_t threads) {
+  vector<vector<void *>> inputs = makeIO(), outputs = makeIO();
+  stdEng *eng = new stdEng("bench", 1, "vkmincomp", 1);
+  setupEngine(eng, inputs, outputs);
+  eng->setQueueCount(threads);
+  eng->build();
+  auto work = [&]() {
+    vector<float> in(WIDTH, 1.0f), out(WIDTH);
+    for (uint32_t i = 0; i < iters; ++i)
+      eng->runConcurrent({in.data()}, {out.data()});
+  };
+  work(); // the lane of the main thread, and a warm up
+  vector<thread> pool;
+  auto start = chrono::steady_clock::now();
+  for (uint32_t t = 0; t < threads; ++t)
+    pool.push_back(thread(work));
+  for (thread &t : pool)
+    t.join();
+  double jobsPerSec = double(iters) * threads * 1e6 / usSince(start);
+  delete eng;
+  return jobsPerSec;
+}
+
+/* vkmincomp_bench [iterations] [--json file] [--csv file] [--trace file]
+ *                 [--sizes bytes,bytes,...]
+ */
+int main(int argc, char **argv) {
+  uint32_t iters = 1000;
+  const char *jsonPath = nullptr, *csvPath = nullptr, *tracePath = nullptr;
+  vector<size_t> sizes = {size_t(4) << 10, size_t(64) << 10, size_t(1) << 20,
+                          size_t(16) << 20};
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (arg == "--json" && value)
+      jsonPath = argv[++i];
+    else if (arg == "--csv" && value)
+      csvPath = argv[++i];
+    else if (arg == "--trace" && value)
+      tracePath = argv[++i];
+    else if (arg == "--sizes" && value) {
+      sizes.clear();
+      stringstream list(argv[++i]);
+      for (string size; getline(list, size, ',');)
+        sizes.push_back(max<size_t>(stoull(size), sizeof(float)));
+    } else
+      iters = max(uint32_t(atoi(argv[i])), 1u);
+  }
+  uint32_t rebuildIters = iters / 50 ? iters / 50 : 1;
+  if (tracePath)
+    tracer::enable(true);
+
+  double instanceUs, deviceUs;
+  string device;
+  benchStartup(rebuildIters, instanceUs, deviceUs, device);
+  report("instance_create", 0, instanceUs, "us");
+  report("device_create", 0, deviceUs, "us");
+  double emptyUs = benchEmptyDispatch(iters);
+  report("empty_dispatch", sizeof(float), emptyUs, "us");
+  cout << "device " << device << endl;
+  cout << "\tinstance creation = " << instanceUs << " us" << endl;
+  cout << "\tdevice creation   = " << deviceUs << " us" << endl;
+  cout << "\tempty dispatch    = " << emptyUs << " us round trip" << endl;
+  double ownUs, sharedUs;
+  benchSharedContext(rebuildIters, ownUs, sharedUs);
+  report("engine_own_context", 0, ownUs, "us");
+  report("engine_shared_context", 0, sharedUs, "us");
+  cout << "\tengine with its own device = " << ownUs << " us" << endl;
+  cout << "\tengine on a shared context = " << sharedUs << " us" << endl;
+
+  cout << "buffer size sweep" << endl;
+  for (size_t bytes : sizes) {
+    size_t first = results.size();
+    // large buffers get fewer runs, about 1 GB moved per size at most
+    benchSize(bytes,
+              uint32_t(max<size_t>(min<size_t>(iters, (1u << 30) / bytes), 1)));
+    cout << "\t" << bytes << " bytes:";
+    for (size_t i = first; i < results.size(); ++i)
+      cout << " " << results[i].name << " " << results[i].value << " "
+           << results[i].unit << ";";
+    cout << endl;
+  }
+
+  double before = benchRebuild(rebuildIters);
+  recordStats rec, reusedRec;
+  double after = benchDispatch(iters, false, rec);
+  double recordOnce = benchDispatch(iters, true, reusedRec);
+  cout << "per-dispatch latency" << endl;
+  cout << "\trebuild every run = " << before << " us (" << rebuildIters
+       << " iterations)" << endl;
+  cout << "\tbuild once        = " << after << " us (" << iters
+       << " iterations)" << endl;
+  cout << "\trecord once       = " << recordOnce << " us" << endl;
+  report("rebuild_every_run", WIDTH * sizeof(float), before, "us");
+  report("dispatch", WIDTH * sizeof(float), after, "us");
+  report("dispatch_recorded_once", WIDTH * sizeof(float), recordOnce, "us");
+  bool address;
+  double addressUs = benchAddress(iters, address);
+  if (address)
+    cout << "\tdevice addresses  = " << addressUs << " us" << endl;
+  else
+    cout << "\tdevice addresses  = not supported" << endl;
+  cout << "command recording" << endl;
+  cout << "\tevery submit = " << rec.recordings << " recordings, "
+       << rec.nanoseconds / 1000.0 / max<uint64_t>(rec.recordings, 1)
+       << " us each" << endl;
+  cout << "\treused       = " << reusedRec.recordings << " recordings, "
+       << reusedRec.reuses << " reuses" << endl;
+
+  profileStats prof = benchProfile(iters);
+  uint64_t subs = max<uint64_t>(prof.submissions, 1);
+  uint64_t timed = max<uint64_t>(prof.timedSubmissions, 1);
+  cout << "profile" << endl;
+  for (auto &phase : prof.buildPhases)
+    cout << "\t" << phase.first << " = " << phase.second / 1000.0 << " us"
+         << endl;
+  cout << "\thost per submission: fill " << prof.fillNanoseconds / subs
+       << " ns, record " << prof.recordNanoseconds / subs << " ns, submit "
+       << prof.submitNanoseconds / subs << " ns, wait "
+       << prof.waitNanoseconds / subs << " ns" << endl;
+  cout << "\tgpu per submission: upload " << prof.uploadNanoseconds / timed
+       << " ns, barriers " << prof.barrierNanoseconds / timed
+       << " ns, dispatch " << prof.dispatchNanoseconds / timed
+       << " ns, download " << prof.downloadNanoseconds / timed << " ns"
+       << endl;
+
+  cout << "asynchronous submit" << endl;
+  for (uint32_t frames : {1u, 2u, 3u}) {
+    uint32_t queues = 1;
+    double us = benchAsync(iters, frames, queues);
+    cout << "\t" << frames << " frame(s) in flight = " << us
+         << " us per submission" << endl;
+  }
+  // one queue per frame, as many as the device has
+  uint32_t queues = 0;
+  double us = benchAsync(iters, 3, queues);
+  cout << "\t3 frames on " << queues << " queue(s) = " << us
+       << " us per submission" << endl;
+
+  cout << "streaming 16 MiB" << endl;
+  for (uint32_t frames : {1u, 2u, 3u}) {
+    streamStats stats = benchStream(size_t(16) << 20, frames);
+    cout << "\t" << frames << " frame(s) in flight = " << stats.gbPerSec
+         << " GB/s (" << stats.chunks << " chunks)" << endl;
+  }
+
+  cout << "concurrent host threads" << endl;
+  uint32_t maxThreads = max(thread::hardware_concurrency(), 1u);
+  for (uint32_t threads = 1; threads <= maxThreads; threads *= 2)
+    cout << "\t" << threads << " thread(s) = "
+         << benchThreads(iters / threads + 1, threads) << " jobs/s" << endl;
+
+  double batchRate;
+  descCacheStats desc;
+  double singleRate = benchBatch(iters, batchRate, desc);
+  cout << "small jobs" << endl;
+  cout << "\tone submit per job = " << singleRate << " jobs/s" << endl;
+  cout << "\tone batch submit   = " << batchRate << " jobs/s" << endl;
+  cout << "descriptor cache" << endl;
+  cout << "\t" << desc.misses << " writes (" << desc.recycled
+       << " recycled), "
+       << desc.updateNanoseconds / 1000.0 / max<uint64_t>(desc.misses, 1)
+       << " us each, hit rate " << desc.hitRate << endl;
+
+  cout << "two stage pipeline" << endl;
+  double chainedUs;
+  double graphUs = benchGraph(iters, chainedUs);
+  cout << "\ttwo engines through the host = " << chainedUs << " us" << endl;
+  cout << "\tone kernel graph             = " << graphUs << " us" << endl;
+
+  double coldUs, warmUs;
+  benchPipelineCache(coldUs, warmUs);
+  cout << "pipeline creation" << endl;
+  cout << "\tcold cache = " << coldUs << " us" << endl;
+  cout << "\twarm cache = " << warmUs << " us" << endl;
+  report("pipeline_cold", 0, coldUs, "us");
+  report("pipeline_warm", 0, warmUs, "us");
+
+  double serialUs, parallelUs;
+  uint32_t pipelines, threads;
+  benchPipelineBatch(serialUs, parallelUs, pipelines, threads);
+  cout << "creating " << pipelines << " pipeline variants" << endl;
+  cout << "\tone after another  = " << serialUs << " us" << endl;
+  cout << "\ton " << threads << " threads = " << parallelUs << " us" << endl;
+  report("pipelines_serial", 0, serialUs, "us");
+  report("pipelines_parallel", 0, parallelUs, "us");
+
+  bool reused;
+  tuneEntry best = benchAutotune(reused);
+  cout << "autotune" << endl;
+  cout << "\tbest local size = " << best.localSize[0] << "x"
+       << best.localSize[1] << "x" << best.localSize[2] << " ("
+       << best.gpuTime << " ns)" << endl;
+  cout << "\tused by next build = " << (reused ? "yes" : "no") << endl;
+
+  vector<double> weights;
+  splitStats split = benchSplit(rebuildIters, weights);
+  cout << "split over " << split.devices << " logical devices" << endl;
+  cout << "\t" << split.elemsPerSec << " elements/s, weights";
+  for (double w : weights)
+    cout << " " << w;
+  cout << endl;
+  if (tracePath && !tracer::writeChromeJson(tracePath))
+    cout << "Could not write " << tracePath << endl;
+  if (jsonPath && !writeJson(jsonPath, device, iters))
+    cout << "Could not write " << jsonPath << endl;
+  if (csvPath && !writeCsv(csvPath))
+    cout << "Could not write " << csvPath << endl;
+  return 0;
+}
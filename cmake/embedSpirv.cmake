@@ -0,0 +1,42 @@
+# Tulis file SPIR-V sebagai array constexpr uint32_t untuk
+# stdEng::setShaderCode, jadi shader tidak dibaca dari disk saat runtime.
+#
+# cmake -DSPV=compute.spv -DHXX=compute_spv.hxx -DNAME=computeSpv
+#       -P embedSpirv.cmake
+
+file(READ ${SPV} hex HEX)
+string(LENGTH "${hex}" len)
+math(EXPR rem "${len} % 8")
+if(len EQUAL 0 OR NOT rem EQUAL 0)
+    message(FATAL_ERROR "${SPV} bukan SPIR-V (ukuran bukan kelipatan 4)")
+endif()
+
+# file SPIR-V little endian, byte 0 adalah byte terendah dari word
+set(words "")
+set(count 0)
+math(EXPR last "${len} - 8")
+foreach(i RANGE 0 ${last} 8)
+    string(SUBSTRING "${hex}" ${i} 8 word)
+    string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1," word "${word}")
+    math(EXPR count "${count} + 1")
+    math(EXPR col "${count} % 6")
+    if(col EQUAL 0)
+        string(APPEND words "${word}\n    ")
+    else()
+        string(APPEND words "${word} ")
+    endif()
+endforeach()
+
+string(TOUPPER ${NAME} guard)
+file(WRITE ${HXX}
+"// dibuat oleh cmake/embedSpirv.cmake dari ${SPV}, jangan diedit
+#ifndef _${guard}_HXX
+#define _${guard}_HXX
+
+#include <cstdint>
+
+constexpr uint32_t ${NAME}[] = {
+    ${words}};
+
+#endif // _${guard}_HXX
+")
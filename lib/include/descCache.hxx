@@ -0,0 +1,81 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// Licensed under GNU GPL v3
+// For more information, see https://www.gnu.org/licenses/gpl-3.0.html
+#ifndef _DESCCACHE_HXX
+#define _DESCCACHE_HXX
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+using namespace std;
+using namespace vk;
+
+namespace vkmincomp {
+
+// how well descCache reused descriptor sets
+struct descCacheStats {
+  uint64_t hits = 0, misses = 0;
+  // misses served by sets of an evicted entry instead of a new allocation
+  uint64_t recycled = 0;
+  // time spent writing descriptors, in nanoseconds
+  uint64_t updateNanoseconds = 0;
+  double hitRate = 0;
+};
+
+/* Descriptor sets by the buffers they point at
+ *
+ * One group holds a set for every set layout of the kernel. get() returns the
+ * group written for the same (buffer, offset, range) tuple when there is one
+ * and writes a new group otherwise, with a descriptor update template per
+ * set when the device has them. A group whose buffer is destroyed goes to a
+ * free list and is written again for the next miss, trim() gives those back
+ * to their pool.
+ */
+class descCache {
+
+private:
+  struct group {
+    vector<DescriptorSet> sets;
+    uint32_t pool = 0;
+  };
+
+  Device dev;
+  vector<DescriptorSetLayout> setLays;
+  // set and binding of every buffer, in the order of descBuffInfos
+  vector<pair<uint32_t, uint32_t>> slots;
+  uint32_t sumBind = 0;
+  // one per set, null for a set without buffers
+  vector<DescriptorUpdateTemplate> templates;
+  vector<DescriptorPool> pools;
+  // groups each pool can still allocate and holds at all
+  vector<uint32_t> poolLeft, poolSizes;
+  uint32_t groupsPerPool = 1;
+  map<vector<tuple<Buffer, DeviceSize, DeviceSize>>, group> entries;
+  vector<group> freeGroups;
+  descCacheStats stats;
+  mutex lock;
+
+  void addPool();
+
+public:
+  void init(Device dev, const vector<DescriptorSetLayout> &setLays,
+            const vector<uint32_t> &bindings,
+            const vector<pair<uint32_t, uint32_t>> &slots,
+            uint32_t groupsPerPool, bool useTemplates);
+  void write(const DescriptorSet *sets,
+             const vector<DescriptorBufferInfo> &descBuffInfos);
+  vector<DescriptorSet> get(const vector<DescriptorBufferInfo> &descBuffInfos);
+  void evict(Buffer buff);
+  void trim();
+  descCacheStats getStats();
+  void destroy();
+};
+
+} // namespace vkmincomp
+
+#endif // _DESCCACHE_HXX
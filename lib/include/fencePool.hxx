@@ -0,0 +1,36 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// Licensed under GNU GPL v3
+// For more information, see https://www.gnu.org/licenses/gpl-3.0.html
+#ifndef _FENCEPOOL_HXX
+#define _FENCEPOOL_HXX
+
+#include <cstddef>
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+
+using namespace std;
+using namespace vk;
+
+namespace vkmincomp {
+
+/* Fences are created once and recycled, a submission takes an unsignaled one
+ * with acquire() and gives it back with release() after it was waited on.
+ */
+class fencePool {
+
+private:
+  Device dev;
+  vector<Fence> freeFences;
+  uint32_t created = 0;
+
+public:
+  void init(Device dev, uint32_t count);
+  Fence acquire();
+  void release(Fence fence);
+  uint32_t size();
+  void destroy();
+};
+
+} // namespace vkmincomp
+
+#endif // _FENCEPOOL_HXX
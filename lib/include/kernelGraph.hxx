@@ -0,0 +1,110 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// Licensed under GNU GPL v3
+// For more information, see https://www.gnu.org/licenses/gpl-3.0.html
+#ifndef _KERNELGRAPH_HXX
+#define _KERNELGRAPH_HXX
+
+#include <cstddef>
+#include <cstdint>
+#include <memArena.hxx>
+#include <vulkan/vulkan.hpp>
+
+using namespace std;
+using namespace vk;
+
+namespace vkmincomp {
+
+class stdEng;
+
+/* What a graph buffer is used for
+ * GRAPH_INPUT is written by the host, GRAPH_OUTPUT is read by the host and
+ * GRAPH_INTERMEDIATE never leaves the device.
+ */
+enum GraphBuffer { GRAPH_INPUT, GRAPH_OUTPUT, GRAPH_INTERMEDIATE };
+
+/* Several kernels recorded into one command buffer
+ *
+ * Every kernel declares the buffers it reads and writes, they are bound in
+ * set 0 in that order, the reads first. Kernels are put on levels: a kernel
+ * that touches a buffer written or read by an earlier kernel goes one level
+ * after it. One pipelineBarrier separates two levels and covers only the
+ * buffers the later level depends on, kernels on the same level run without
+ * any barrier between them.
+ *
+ * The device, queue and memory come from the engine given to the constructor.
+ */
+class kernelGraph {
+
+private:
+  struct graphBuff {
+    GraphBuffer use;
+    DeviceSize size;
+    Buffer buff;
+    memAlloc alloc;
+    bool coherent = true;
+  };
+  struct graphKernel {
+    // the file is read by build() when there is no embedded code
+    const char *filepath = nullptr;
+    const uint32_t *code = nullptr;
+    size_t codeSize = 0;
+    const char *entryPoint;
+    vector<uint32_t> reads, writes;
+    uint32_t width, height, depth;
+    ShaderModule shadMod;
+    DescriptorSetLayout descSetLay;
+    PipelineLayout pipeLay;
+    Pipeline pipe;
+    DescriptorSet descSet;
+    uint32_t level = 0;
+  };
+
+  stdEng &eng;
+  Device dev;
+  vector<graphBuff> buffs;
+  vector<graphKernel> kernels;
+  DescriptorPool descPool;
+  CommandPool cmdPool;
+  CommandBuffer cmdBuff;
+  uint32_t levelCount = 0, barrierCount = 0;
+  bool built = false;
+
+  void allocateBuffers();
+  void createPipelines();
+  void schedule();
+  void record();
+
+public:
+  kernelGraph(stdEng &eng);
+
+  uint32_t addBuffer(DeviceSize size, GraphBuffer use);
+  uint32_t addKernel(const char *filepath, const char *entryPoint,
+                     vector<uint32_t> reads, vector<uint32_t> writes,
+                     uint32_t width, uint32_t height, uint32_t depth);
+  uint32_t addKernel(const uint32_t *code, size_t size, const char *entryPoint,
+                     vector<uint32_t> reads, vector<uint32_t> writes,
+                     uint32_t width, uint32_t height, uint32_t depth);
+  // an embedded array, the size comes from its type
+  template <size_t N>
+  uint32_t addKernel(const uint32_t (&code)[N], const char *entryPoint,
+                     vector<uint32_t> reads, vector<uint32_t> writes,
+                     uint32_t width, uint32_t height, uint32_t depth) {
+    return this->addKernel(code, sizeof(code), entryPoint, reads, writes,
+                           width, height, depth);
+  }
+
+  void build();
+  void run();
+
+  void *inputData(uint32_t buff);
+  void readOutput(uint32_t buff, void *dst, size_t size);
+
+  uint32_t getLevelCount();
+  uint32_t getBarrierCount();
+
+  ~kernelGraph();
+};
+
+} // namespace vkmincomp
+
+#endif // _KERNELGRAPH_HXX
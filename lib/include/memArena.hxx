@@ -0,0 +1,105 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// Licensed under GNU GPL v3
+// For more information, see https://www.gnu.org/licenses/gpl-3.0.html
+#ifndef _MEMARENA_HXX
+#define _MEMARENA_HXX
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vulkan/vulkan.hpp>
+
+using namespace std;
+using namespace vk;
+
+namespace vkmincomp {
+
+/* a sub range of one arena block, bind the buffer at mem + offset
+ * mapped points to the range when the memory type is host visible, the block
+ * stays mapped for its whole lifetime
+ */
+struct memAlloc {
+  DeviceMemory mem;
+  DeviceSize offset = 0;
+  DeviceSize size = 0;
+  void *mapped = nullptr;
+  uint32_t typeIndex = uint32_t(~0);
+  uint32_t block = uint32_t(~0);
+};
+
+struct memArenaStats {
+  uint32_t blockCount = 0;
+  uint32_t allocationCount = 0;
+  uint32_t freeRangeCount = 0;
+  DeviceSize reserved = 0;
+  DeviceSize used = 0;
+  DeviceSize largestFreeRange = 0;
+  // 0 when all free space is one range, close to 1 when it is scattered
+  double fragmentation = 0;
+};
+
+/* Pool of large DeviceMemory blocks per memory type.
+ *
+ * Buffers get sub ranges placed with a best-fit free list that respects
+ * MemoryRequirements::alignment, and bufferImageGranularity between linear
+ * and non linear neighbours. This keeps the number of vkAllocateMemory calls
+ * far below maxMemoryAllocationCount.
+ */
+class memArena {
+
+private:
+  struct range {
+    DeviceSize offset, size;
+  };
+  struct used {
+    DeviceSize size;
+    DeviceSize alignment;
+    bool linear;
+  };
+  struct block {
+    DeviceMemory mem;
+    char *mapped;
+    uint32_t typeIndex;
+    DeviceSize size;
+    vector<range> freeRanges; // sorted by offset, never adjacent
+    map<DeviceSize, used> allocs;
+  };
+
+  Device dev;
+  PhysicalDeviceMemoryProperties memProps;
+  DeviceSize granularity = 1;
+  DeviceSize blockSize = DeviceSize(64) << 20;
+  MemoryAllocateFlags allocFlags;
+  vector<block> blocks;
+
+  bool place(block &blk, DeviceSize size, DeviceSize alignment, bool linear,
+             DeviceSize &offset, size_t &rangeI,
+             DeviceSize limit = DeviceSize(~0));
+  void take(block &blk, size_t rangeI, DeviceSize offset,
+            const used &info);
+  uint32_t createBlock(uint32_t typeIndex, DeviceSize minSize);
+  memAlloc allocateFrom(const MemoryRequirements &memReq, uint32_t typeIndex,
+                        bool linear, uint32_t lastBlock,
+                        DeviceSize lastOffset);
+
+public:
+  void init(PhysicalDevice physdev, Device dev);
+  void setBlockSize(DeviceSize blockSize);
+  void setAllocateFlags(MemoryAllocateFlags allocFlags);
+  uint32_t findMemoryType(uint32_t typeBits, MemoryPropertyFlags required,
+                          MemoryPropertyFlags preferred = {});
+
+  memAlloc allocate(const MemoryRequirements &memReq, uint32_t typeIndex,
+                    bool linear = true);
+  void free(const memAlloc &alloc);
+  uint32_t defragment(
+      function<bool(const memAlloc &from, const memAlloc &to)> move);
+  void trim();
+  memArenaStats getStats();
+  void destroy();
+};
+
+} // namespace vkmincomp
+
+#endif // _MEMARENA_HXX
@@ -0,0 +1,50 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// Licensed under GNU GPL v3
+// For more information, see https://www.gnu.org/licenses/gpl-3.0.html
+#ifndef _PIPELINECACHE_HXX
+#define _PIPELINECACHE_HXX
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vulkan/vulkan.hpp>
+
+using namespace std;
+using namespace vk;
+
+namespace vkmincomp {
+
+// FNV-1a 64 bit, used as the key of anything derived from SPIR-V code
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0);
+
+/* VkPipelineCache backed by a file in a cache directory.
+ *
+ * The file name is built from vendorID, deviceID, pipelineCacheUUID and the
+ * hash of the SPIR-V, so a driver update or a shader change never picks up a
+ * stale blob. The header of the blob is validated again before it is handed
+ * to the driver.
+ */
+class pipelineCache {
+
+private:
+  Device dev;
+  PipelineCache cache;
+  PhysicalDeviceProperties physdevProps;
+  string path;
+  size_t loadedSize = 0;
+  bool warm = false;
+
+  bool validHeader(const vector<char> &data);
+
+public:
+  void open(PhysicalDevice physdev, Device dev, const char *dir,
+            uint64_t spirvHash);
+  PipelineCache get();
+  bool isWarm();
+  void save();
+  void destroy();
+};
+
+} // namespace vkmincomp
+
+#endif // _PIPELINECACHE_HXX
@@ -0,0 +1,50 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// Licensed under GNU GPL v3
+// For more information, see https://www.gnu.org/licenses/gpl-3.0.html
+#ifndef _SHADERCACHE_HXX
+#define _SHADERCACHE_HXX
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vulkan/vulkan.hpp>
+
+using namespace std;
+using namespace vk;
+
+namespace vkmincomp {
+
+/* Shader modules by device and SPIR-V content
+ *
+ * Process wide and thread safe. acquire() hands out the module made before
+ * for the same code on the same device and creates it otherwise, release()
+ * destroys it when its last user lets go. Engines and kernel graphs on one
+ * device share their modules this way.
+ */
+class shaderCache {
+
+private:
+  struct entry {
+    ShaderModule mod;
+    uint32_t users = 0;
+  };
+
+  static mutex lock;
+  // device, hashBytes() of the code and its size
+  static map<tuple<Device, uint64_t, size_t>, entry> modules;
+  static uint64_t hits, misses;
+
+public:
+  static ShaderModule acquire(Device dev, const uint32_t *code, size_t size,
+                              uint64_t hash);
+  static void release(Device dev, ShaderModule mod);
+  static size_t getModuleCount();
+  static uint64_t getHits();
+  static uint64_t getMisses();
+};
+
+} // namespace vkmincomp
+
+#endif // _SHADERCACHE_HXX
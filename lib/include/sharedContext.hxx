@@ -0,0 +1,90 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// Licensed under GNU GPL v3
+// For more information, see https://www.gnu.org/licenses/gpl-3.0.html
+#ifndef _SHAREDCONTEXT_HXX
+#define _SHAREDCONTEXT_HXX
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <submitQueue.hxx>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+using namespace std;
+using namespace vk;
+
+namespace vkmincomp {
+
+/* The Vulkan instance, device and queues of one or more engines
+ *
+ * Nothing is made by the constructor. The instance comes with the first call
+ * that needs it, the device with the first open(), on the physical device and
+ * with the queue count and priority of that call. Later engines get the same
+ * device and at most as many queues. Buffer device addresses and host memory
+ * import are enabled whenever the device has them, so every engine on it can
+ * use them.
+ *
+ * Reference counted: every engine on it holds a reference and releases it in
+ * its destructor, the last release destroys the device and the instance. The
+ * submissions of all its engines go through one submitQueue, so a queue is
+ * never used by two threads at once.
+ */
+class sharedContext {
+  friend class stdEng;
+  friend class kernelGraph;
+
+private:
+  atomic<uint32_t> refs{1};
+  mutex lock;
+  ApplicationInfo appInfo;
+  InstanceCreateInfo instInfo;
+  Instance inst;
+  PhysicalDevice physdev;
+  uint32_t queueFamIndex = 0, transferFamIndex = 0;
+  uint32_t queueCount = 0, transferQueueCount = 1;
+  vector<float> queuePriorities;
+  DeviceQueueCreateInfo devQInfo;
+  vector<DeviceQueueCreateInfo> devQInfos;
+  DeviceCreateInfo devInfo;
+  vector<const char *> devExts;
+  Device dev;
+  DispatchLoaderDynamic dld;
+  bool hostImport = false;
+  DeviceSize hostImportAlign = 1;
+  bool address = false, addressCore = false;
+  PhysicalDeviceBufferDeviceAddressFeatures addrFeatures;
+  submitQueue submits;
+
+  // the context of acquire(), null when nobody holds it
+  static mutex globalLock;
+  static sharedContext *global;
+
+  ~sharedContext();
+  static uint64_t scoreDevice(PhysicalDevice physdev);
+  void makeInstance();
+  vector<uint32_t> rank();
+  bool addressSupported(PhysicalDevice physdev);
+
+public:
+  sharedContext(const char *appname, uint32_t appvers, const char *engname,
+                uint32_t engvers);
+  sharedContext(const sharedContext &) = delete;
+  sharedContext &operator=(const sharedContext &) = delete;
+
+  static sharedContext *acquire(const char *appname, uint32_t appvers,
+                                const char *engname, uint32_t engvers);
+  void retain();
+  void release();
+  uint32_t getRefCount();
+
+  Instance getInstance();
+  vector<uint32_t> rankDevices();
+  bool addressSupported(uint32_t physdevIndex);
+  bool open(uint32_t physdevIndex, uint32_t queueCount, float priority);
+  bool isOpen();
+};
+
+} // namespace vkmincomp
+
+#endif // _SHAREDCONTEXT_HXX
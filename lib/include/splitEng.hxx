@@ -0,0 +1,81 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// Licensed under GNU GPL v3
+// For more information, see https://www.gnu.org/licenses/gpl-3.0.html
+#ifndef _SPLITENG_HXX
+#define _SPLITENG_HXX
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+using namespace std;
+
+namespace vkmincomp {
+
+class stdEng;
+
+// how one splitEng::run() went
+struct splitStats {
+  uint32_t devices = 0;
+  uint64_t nanoseconds = 0;
+  double elemsPerSec = 0;
+};
+
+/* One large dispatch spread over several devices
+ *
+ * Input 0 and output 0 hold elemCount elements and are cut into one range per
+ * device, the other inputs go to every device whole. Each device has its own
+ * stdEng with its own buffers, sized for its range. The ranges follow the
+ * throughput measured on the previous runs, so a faster device gets more
+ * elements. The kernel must treat elements independently, like for stream().
+ *
+ * The same physical device may be listed more than once, each entry gets its
+ * own logical device.
+ */
+class splitEng {
+
+private:
+  struct part {
+    stdEng *eng = nullptr;
+    uint32_t device = 0;
+    // the range of elements, and how many the buffers hold
+    uint32_t first = 0, count = 0, capacity = 0;
+    double weight = 0;
+    uint64_t nanoseconds = 0;
+  };
+
+  const char *appname, *engname;
+  uint32_t appvers, engvers;
+  function<void(stdEng &)> setup;
+  vector<uint32_t> devices;
+  vector<part> parts;
+  uint32_t elemCount = 0;
+  size_t inElemSize = 0, outElemSize = 0;
+  uint32_t rangePush = uint32_t(~0);
+  bool built = false;
+
+  void createEngine(part &p);
+  void assignRanges();
+
+public:
+  splitEng(const char *appname, uint32_t appvers, const char *engname,
+           uint32_t engvers, function<void(stdEng &)> setup);
+
+  void setDevices(vector<uint32_t> devices);
+  void setElementCount(uint32_t elemCount);
+  void setRangePushConstant(uint32_t offset);
+
+  void build();
+  splitStats run(const void *src, void *dst);
+
+  vector<uint32_t> getDevices();
+  vector<double> getWeights();
+  vector<uint32_t> getRanges();
+
+  ~splitEng();
+};
+
+} // namespace vkmincomp
+
+#endif // _SPLITENG_HXX
@@ -0,0 +1,47 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// Licensed under GNU GPL v3
+// For more information, see https://www.gnu.org/licenses/gpl-3.0.html
+#ifndef _STAGINGRING_HXX
+#define _STAGINGRING_HXX
+
+#include <cstddef>
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+
+using namespace std;
+using namespace vk;
+
+namespace vkmincomp {
+
+/* Host visible ring buffer used as the source of uploads and the destination
+ * of downloads when the kernel buffers live in DEVICE_LOCAL memory.
+ *
+ * reserve() hands out ranges after the head, release() moves the tail to a
+ * mark() taken earlier once the gpu is done with everything before it.
+ */
+class stagingRing {
+
+private:
+  Device dev;
+  Buffer buff;
+  DeviceMemory mem;
+  char *ptr = nullptr;
+  DeviceSize size = 0;
+  DeviceSize head = 0, tail = 0;
+  bool empty = true;
+
+public:
+  void create(PhysicalDevice physdev, Device dev, DeviceSize size,
+              const vector<uint32_t> &queueFamIndices);
+  DeviceSize reserve(DeviceSize size, DeviceSize alignment = 16);
+  DeviceSize mark();
+  void release(DeviceSize mark);
+  DeviceSize capacity();
+  Buffer buffer();
+  void *data(DeviceSize offset);
+  void destroy();
+};
+
+} // namespace vkmincomp
+
+#endif // _STAGINGRING_HXX
@@ -0,0 +1,74 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// Licensed under GNU GPL v3
+// For more information, see https://www.gnu.org/licenses/gpl-3.0.html
+#ifndef _SUBMITQUEUE_HXX
+#define _SUBMITQUEUE_HXX
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+using namespace std;
+using namespace vk;
+
+namespace vkmincomp {
+
+/* Every vkQueueSubmit of the engines on a sharedContext goes through here
+ *
+ * A queue must not be used by two threads at once. Instead of a mutex around
+ * it, submit() pushes the work on a lock free multi producer single consumer
+ * list and the thread that finds nobody draining it becomes the consumer for
+ * a pass: it submits the nodes that were there when the pass began, its own
+ * work and that of the other threads, in push order. Every thread returns
+ * once its own node was submitted, by itself or by another one, so a busy
+ * queue does not keep one caller submitting the work of the others.
+ *
+ * A failed vkQueueSubmit is reported by the thread that owns the work, the
+ * consumer only stores the result in its node.
+ */
+class submitQueue {
+
+private:
+  /* a copy of the SubmitInfo, the pointers in it may not outlive submit().
+   * It lives on the stack of submit(), done hands it back to its owner.
+   */
+  struct node {
+    atomic<node *> next{nullptr};
+    Queue queue;
+    vector<Semaphore> waitSems, signalSems;
+    vector<PipelineStageFlags> waitStages;
+    vector<CommandBuffer> cmdBuffs;
+    Fence fence;
+    Result result = Result::eSuccess;
+    atomic<bool> done{false};
+  };
+
+  // producers swap head, the consumer walks from tail, stub keeps it non empty
+  atomic<node *> head;
+  node *tail;
+  node stub;
+  // nodes counted before their push and not submitted yet, so it never wraps
+  atomic<uint32_t> pending{0};
+  atomic<bool> draining{false};
+  atomic<uint64_t> submitCount{0};
+
+  void push(node *n);
+  node *pop();
+  void drainPass();
+
+public:
+  submitQueue();
+  submitQueue(const submitQueue &) = delete;
+  submitQueue &operator=(const submitQueue &) = delete;
+
+  void submit(Queue queue, const SubmitInfo &info, Fence fence = Fence());
+  void flush();
+  uint64_t getSubmitCount();
+
+  ~submitQueue();
+};
+
+} // namespace vkmincomp
+
+#endif // _SUBMITQUEUE_HXX
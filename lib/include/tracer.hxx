@@ -0,0 +1,100 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// Licensed under GNU GPL v3
+// For more information, see https://www.gnu.org/licenses/gpl-3.0.html
+#ifndef _TRACER_HXX
+#define _TRACER_HXX
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace vkmincomp {
+
+// one entry of a trace, name must be a string literal or live as long
+struct traceEvent {
+  uint64_t ns;
+  const char *name;
+  /* a duration for 'X', the number of a 'C' counter or an 'i' instant. The
+   * value of an instant is signed, a VkResult error reads -4, in two's
+   * complement here.
+   */
+  uint64_t value;
+  // 'B' begin, 'E' end, 'X' complete span, 'C' counter, 'i' instant
+  char type;
+};
+
+/* Process wide event trace
+ *
+ * Every thread writes to a ring of its own, so recording an event is a clock
+ * read and one store, without a lock or a shared cache line. When the ring is
+ * full the oldest events are overwritten. Disabled, every call is one relaxed
+ * load and a branch.
+ *
+ * The rings are read by writeChromeJson and writeBinary, call them when the
+ * traced threads are quiet, the export does not stop them.
+ */
+class tracer {
+
+private:
+  struct ring {
+    vector<traceEvent> events;
+    uint64_t mask;
+    atomic<uint64_t> written{0};
+    uint32_t tid;
+    ring *next = nullptr;
+  };
+
+  static atomic<bool> on;
+  static atomic<ring *> rings;
+  static atomic<uint32_t> nextTid;
+  static atomic<uint32_t> capacity;
+  static chrono::steady_clock::time_point epoch;
+
+  static ring *threadRing();
+  static void record(const char *name, char type, uint64_t value,
+                     uint64_t ns);
+  static uint64_t now();
+  static vector<pair<uint32_t, traceEvent>> collect();
+
+public:
+  static void enable(bool enable, uint32_t capacity = 1u << 16);
+  static bool enabled() { return on.load(memory_order_relaxed); }
+
+  static void begin(const char *name);
+  static void end(const char *name);
+  static void span(const char *name, chrono::steady_clock::time_point start,
+                   chrono::steady_clock::time_point finish);
+  static void counter(const char *name, uint64_t value);
+  static void instant(const char *name, int64_t value = 0);
+
+  static bool writeChromeJson(const char *path);
+  static bool writeBinary(const char *path);
+  static void clear();
+};
+
+// begin in the constructor and end in the destructor, for a block
+class traceScope {
+
+private:
+  const char *name;
+
+public:
+  traceScope(const char *name) : name(name) {
+    if (tracer::enabled())
+      tracer::begin(name);
+  }
+  traceScope(const traceScope &) = delete;
+  traceScope &operator=(const traceScope &) = delete;
+  ~traceScope() {
+    if (tracer::enabled())
+      tracer::end(this->name);
+  }
+};
+
+} // namespace vkmincomp
+
+#endif // _TRACER_HXX
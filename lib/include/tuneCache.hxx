@@ -0,0 +1,54 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// Licensed under GNU GPL v3
+// For more information, see https://www.gnu.org/licenses/gpl-3.0.html
+#ifndef _TUNECACHE_HXX
+#define _TUNECACHE_HXX
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vulkan/vulkan.hpp>
+
+using namespace std;
+using namespace vk;
+
+namespace vkmincomp {
+
+// the best launch shape autotune found for one kernel on one device
+struct tuneEntry {
+  uint32_t localSize[3] = {1, 1, 1};
+  uint32_t tile = 1;
+  // gpu time of one dispatch in nanoseconds
+  uint64_t gpuTime = 0;
+};
+
+/* Autotune results in a small text file, one line per device, driver, kernel
+ * and element count:
+ *
+ *   vendorID deviceID driverVersion kernelHash x y z : lx ly lz tile ns
+ *
+ * A line for another device or driver is simply never looked up, so one file
+ * can be shared by every machine that runs the same build.
+ */
+class tuneCache {
+
+private:
+  string path;
+  PhysicalDeviceProperties physdevProps;
+  map<string, tuneEntry> entries;
+
+  string key(uint64_t kernelHash, const uint32_t elemCount[3]);
+
+public:
+  void open(PhysicalDevice physdev, const string &path);
+  bool find(uint64_t kernelHash, const uint32_t elemCount[3],
+            tuneEntry &entry);
+  void store(uint64_t kernelHash, const uint32_t elemCount[3],
+             const tuneEntry &entry);
+  bool save();
+};
+
+} // namespace vkmincomp
+
+#endif // _TUNECACHE_HXX
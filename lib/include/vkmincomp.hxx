@@ -4,9 +4,28 @@
 #ifndef _VKMINCOMP_HXX
 #define _VKMINCOMP_HXX
 
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <descCache.hxx>
+#include <fencePool.hxx>
+#include <functional>
+#include <kernelGraph.hxx>
+#include <map>
+#include <memArena.hxx>
+#include <mutex>
+#include <pipelineCache.hxx>
+#include <shaderCache.hxx>
+#include <sharedContext.hxx>
+#include <splitEng.hxx>
+#include <stagingRing.hxx>
+#include <submitQueue.hxx>
+#include <string>
+#include <tracer.hxx>
+#include <tuneCache.hxx>
+#include <type_traits>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_handles.hpp>
@@ -19,101 +38,478 @@ namespace vkmincomp {
 
 enum DebugMode { VERBOSE, STANDARD, NO };
 
+/* Where the input and output buffers live
+ * AUTO picks DEVICE_LOCAL on discrete devices and HOST_VISIBLE on UMA ones.
+ */
+enum MemoryPlacement { AUTO, DEVICE_LOCAL, HOST_VISIBLE };
+
+// typed view over memory owned by the engine, like a span without C++20
+template <typename T> class bufView {
+
+private:
+  T *ptr = nullptr;
+  size_t count = 0;
+
+public:
+  bufView() {}
+  bufView(T *ptr, size_t count) : ptr(ptr), count(count) {}
+
+  T *data() const { return this->ptr; }
+  size_t size() const { return this->count; }
+  bool empty() const { return this->count == 0; }
+  T &operator[](size_t i) const { return this->ptr[i]; }
+  T *begin() const { return this->ptr; }
+  T *end() const { return this->ptr + this->count; }
+};
+
+// what stdEng::stream() moved and how fast
+struct streamStats {
+  uint64_t chunks = 0;
+  uint64_t bytesIn = 0, bytesOut = 0;
+  uint64_t nanoseconds = 0;
+  // sustained (bytesIn + bytesOut) per second over the whole stream
+  double gbPerSec = 0;
+};
+
+// how fast stdEng::runBatch() went
+struct batchStats {
+  uint32_t jobs = 0;
+  uint64_t nanoseconds = 0;
+  double jobsPerSec = 0;
+};
+
+// how often submit() recorded command buffers and what it cost
+struct recordStats {
+  uint64_t recordings = 0;
+  // submissions that sent the command buffers recorded before as they were
+  uint64_t reuses = 0;
+  // time spent recording, in nanoseconds
+  uint64_t nanoseconds = 0;
+};
+
+/* Where the time of an engine went, see stdEng::setProfiling. In
+ * nanoseconds, the per submission times are sums over the profiled
+ * submissions.
+ */
+struct profileStats {
+  // host time of every step of build(), in order
+  vector<pair<string, uint64_t>> buildPhases;
+  uint64_t submissions = 0;
+  // host side of submit(): filling the inputs, recording and submitting
+  uint64_t fillNanoseconds = 0, recordNanoseconds = 0, submitNanoseconds = 0;
+  // host time blocked on the fence of a frame
+  uint64_t waitNanoseconds = 0;
+  // gpu side from timestamps, of the submissions seen done so far. Copies on
+  // a dedicated transfer queue are not timed, see setProfiling.
+  uint64_t timedSubmissions = 0;
+  uint64_t uploadNanoseconds = 0, barrierNanoseconds = 0;
+  uint64_t dispatchNanoseconds = 0, downloadNanoseconds = 0;
+  // the kernel alone in the last timed submission
+  uint64_t lastDispatchNanoseconds = 0;
+};
+
+// one pipeline for stdEng::createPipelines, an entry point and its constants
+struct kernelVariant {
+  string entryPoint = "main";
+  map<uint32_t, uint32_t> specConsts;
+  // the local size constants 0, 1 and 2 when x is not 0, see setLocalSize
+  uint32_t localSize[3] = {0, 0, 0};
+};
+
+// what stdEng::createPipelines made and how long it took
+struct pipelineBuildStats {
+  // pipelines created, the ones the engine had already are not counted
+  uint32_t pipelines = 0;
+  uint32_t threads = 0;
+  uint64_t nanoseconds = 0;
+};
+
+class stdEng;
+
+/* Completion handle of one stdEng::submit()
+ *
+ * Its outputs can be read once it is ready, until the engine submits its
+ * frame again, that is framesInFlight submissions later.
+ */
+class submission {
+  friend class stdEng;
+
+private:
+  stdEng *eng = nullptr;
+  uint32_t frame = 0;
+  uint64_t serial = 0;
+
+public:
+  bool valid() const;
+  bool ready() const;
+  Result wait(uint64_t timeout = uint64_t(-1)) const;
+  uint64_t id() const { return this->serial; }
+};
+
 class stdEng {
+  friend class submission;
+  friend class kernelGraph;
 
 private:
+  /* Everything a submission in flight owns. Frames are used round robin, so
+   * the host fills frame N+1 while the gpu still runs frame N.
+   */
+  struct frame {
+    vector<Buffer> inBuffs, outBuffs;
+    vector<memAlloc> inAllocs, outAllocs;
+    vector<void *> inHostPtrs;
+    vector<DeviceMemory> inImported;
+    vector<DescriptorSet> descSets;
+    // address mode: inputs then outputs, pushed in place of descSets
+    vector<DeviceAddress> addrs;
+    CommandPool cmdPool, transferCmdPool;
+    vector<CommandBuffer> cmdBuffs, transferCmdBuffs;
+    Semaphore uploadSem, computeSem;
+    vector<DeviceSize> inStageOffsets, outStageOffsets;
+    vector<DeviceSize> pendingInOffsets, pendingOutOffsets;
+    // staging range each input was last written to, ~0 when never
+    vector<DeviceSize> inWrittenOffsets;
+    // end of the staging ranges of the last submission, released on the next
+    DeviceSize stageEnd = DeviceSize(~0), pendingEnd = DeviceSize(~0);
+    bool staged = false;
+    uint64_t inputsGen = 0;
+    Fence fence;
+    uint64_t serial = 0;
+    // index into queues of its last submission
+    uint32_t queueI = 0;
+    // what the command buffers were recorded with, when they may be reused
+    bool recorded = false;
+    Pipeline recPipe;
+    uint32_t recGroups[3] = {0, 0, 0};
+    vector<char> recPush;
+    // timestamps around the copies, barriers and dispatch, when profiling
+    QueryPool queryPool;
+    bool stamped = false;
+  };
+
   DebugMode debugMode = DebugMode::NO;
-  uint32_t width, height, depth;
+  uint32_t width = 1, height = 1, depth = 1;
+  // 0 keeps the local size of the shader, shadLocalSize
+  uint32_t localSize[3] = {0, 0, 0};
+  uint32_t shadLocalSize[3] = {1, 1, 1};
+  // 0 dispatches width, height and depth workgroups
+  uint32_t elemCount[3] = {0, 0, 0};
+  map<uint32_t, uint32_t> specConsts;
+  uint32_t tileId = uint32_t(~0);
+  tuneCache tuning;
+  const char *tuneFile = nullptr;
+  bool tuned = false;
 
-  ApplicationInfo appInfo;
-  InstanceCreateInfo instInfo;
-  Instance inst;
+  // owns the instance, device and queues, the members below are copies
+  sharedContext *ctx;
   PhysicalDevice physdev;
-  uint32_t queueFamIndex;
+  // ~0 takes the best scored device
+  uint32_t physdevIndex = uint32_t(~0);
+  uint32_t queueFamIndex, transferFamIndex;
   DeviceQueueCreateInfo devQInfo;
   DeviceCreateInfo devInfo;
   Device dev;
+  DispatchLoaderDynamic dld;
+  bool hostImport = false;
+  DeviceSize hostImportAlign = 1;
+  // buffers reached through their device address instead of descriptors
+  bool addressMode = false, addressCore = false;
+  MemoryPlacement placement = MemoryPlacement::AUTO;
+  bool deviceLocal = false;
+  vector<uint32_t> buffFamIndices;
   vector<BufferCreateInfo> inBuffInfos, outBuffInfos;
-  vector<Buffer> inBuffs, outBuffs;
   vector<MemoryRequirements> inMemReqs, outMemReqs;
-  vector<MemoryAllocateInfo> inMemAllocInfos, outMemAllocInfos;
-  vector<DeviceMemory> inMems, outMems;
+  memArena arena;
+  uint32_t memTypeIndex, outMemTypeIndex;
+  bool outCoherent = true;
+  DeviceSize atomSize = 1;
+  stagingRing staging;
+  DeviceSize stagingSize = DeviceSize(16) << 20;
   vector<DescriptorSetLayoutBinding> descSetLayBinds;
   uint32_t sumBind;
-  DescriptorSetLayoutCreateInfo descSetLayInfo;
-  DescriptorSetLayout descSetLay;
+  // one layout per set, bound at its index
+  vector<DescriptorSetLayout> descSetLays;
   ShaderModuleCreateInfo shadModInfo;
   ShaderModule shadMod;
   PipelineShaderStageCreateInfo pipeShadStagInfo;
+  PushConstantRange pushRange;
   PipelineLayoutCreateInfo pipeLayInfo;
   PipelineLayout pipeLay;
   ComputePipelineCreateInfo compPipeInfo;
+  pipelineCache pipeCache;
+  // one pipeline per entry point and specialization tuple, pipe is the
+  // current one
+  map<pair<string, vector<uint32_t>>, Pipeline> variants;
   Pipeline pipe;
-  DescriptorPoolSize descPoolSize;
-  DescriptorPoolCreateInfo descPoolInfo;
-  DescriptorPool descPool;
-  DescriptorSetAllocateInfo descSetAllocInfo;
-  vector<DescriptorSet> descSets;
-  vector<WriteDescriptorSet> writedescsSet;
-  vector<DescriptorBufferInfo> descBuffInfos;
-  vector<WriteDescriptorSet> writeDescSets;
+  descCache descs;
   CommandPoolCreateInfo cmdPoolInfo;
-  CommandPool cmdPool;
   CommandBufferAllocateInfo cmdBuffAllocInfo;
   CommandBufferBeginInfo cmdBuffBeginInfo;
-  vector<CommandBuffer> cmdBuffs;
+  // queue and transferQueue are the first of queues and transferQueues
   Queue queue;
-  Fence fence;
+  Queue transferQueue;
+  vector<Queue> queues, transferQueues;
+  // 0 asks for one queue per frame in flight
+  uint32_t queueCount = 0, transferQueueCount = 1;
+  uint32_t nextQueue = 0;
+  // resources of runBatch, grown to the largest batch so far
+  struct batchRes {
+    vector<Buffer> inBuffs, outBuffs;
+    vector<memAlloc> inAllocs, outAllocs;
+    vector<DeviceSize> inStrides, outStrides;
+    bool outCoherent = true;
+    vector<DescriptorSet> descSets;
+    vector<DeviceAddress> addrs;
+    CommandPool cmdPool;
+    CommandBuffer cmdBuff;
+    uint32_t capacity = 0;
+  };
+
+  /* resources of runConcurrent for one host thread: a one job batchRes with
+   * its own command pool, a secondary command buffer with the dispatch and
+   * what it was recorded with, re-recorded only when that changes
+   */
+  struct lane {
+    batchRes res;
+    CommandBuffer secondary;
+    Fence fence;
+    uint32_t queueI = 0;
+    Pipeline pipe;
+    uint32_t groups[3] = {0, 0, 0};
+    vector<char> pushData;
+  };
+
+  vector<frame> frames;
+  uint32_t framesInFlight = 1, curFrame = 0, lastFrame = 0;
+  uint64_t nextSerial = 1;
+  fencePool fences;
+  batchRes batch;
+  // lanes are made once per thread. The mutex guards the lane list and the
+  // memory arena that lanes, runBatch, kernelGraph and the rest share
+  uint64_t engineId;
+  vector<lane *> lanes;
+  mutex arenaMutex;
   SubmitInfo submitInfo;
-  Result waitFenceRes;
+  Result waitFenceRes = Result::eSuccess;
+  bool reuseCommands = false;
+  recordStats recStats;
+  bool profiling = false;
+  profileStats profile;
+  double stampPeriod = 1;
+  uint64_t stampMask = ~0ull;
+  bool built = false;
 
-  float priority;
+  float priority = 1.0f;
   vector<vector<void *>> inputs;
   vector<uint32_t> inBinding;
   vector<size_t> insizes;
+  uint64_t inputsGen = 0;
+  vector<char> pushData;
+  // input 0 is fed by stream(), setInputs must not overwrite it
+  bool streaming = false;
   vector<vector<void *>> outputs;
   vector<size_t> outsizes;
   vector<uint32_t> bindings;
-  uint32_t IOSetOffset, IOBindingOffset;
+  // where the first output goes, when setBindings was given it
+  bool IOOffsets = false;
+  uint32_t IOSetOffset = 0, IOBindingOffset = 0;
   const char *filepath;
+  const uint32_t *shadCode = nullptr;
+  size_t shadCodeSize = 0;
   const char *entryPoint;
-  uint64_t time;
+  const char *cacheDir = nullptr;
+  uint64_t shadHash = 0;
+  uint64_t pipeCompileTime = 0;
+  uint64_t time = uint64_t(-1);
 
   void createDevice();
+  bool useDeviceLocal();
+  bool dedicatedTransfer();
+  void recordUpload(frame &f, CommandBuffer cmdBuff);
+  void recordDownload(frame &f, CommandBuffer cmdBuff);
   void createBuffer();
   void allocateMemory();
-  void fillInputs();
+  void stageIO(frame &f);
+  frame &acquireFrame();
+  void *inputData(size_t i);
+  const void *outputData(uint32_t frameI, uint64_t serial, size_t i);
+  void fillInputs(frame &f);
   void loadShader();
   void createDescriptorSetLayout();
   void createPipelineLayout();
   void createPipeline();
+  Pipeline pipelineVariant();
+  Pipeline createVariant(const char *entryPoint, const vector<uint32_t> &key,
+                         Result &result, ComputePipelineCreateInfo *info);
+  vector<uint32_t> specKey();
+  static vector<uint32_t> specKey(const map<uint32_t, uint32_t> &specConsts,
+                                  const uint32_t localSize[3]);
+  void groupCount(uint32_t groups[3]);
+  uint64_t kernelHash();
+  string tunePath();
+  void applyTuning();
+  uint64_t timeDispatch(QueryPool queryPool, uint32_t iterations);
   void createDescriptorPool();
+  vector<pair<uint32_t, uint32_t>> bufferSlots();
   void allocateDescriptorSet();
+  void writeDescriptorSets(frame &f);
+  DeviceAddress bufferAddress(Buffer buff);
+  uint32_t addressBytes();
+  void bindBuffers(CommandBuffer cmdBuff, const DescriptorSet *descSets,
+                   const DeviceAddress *addrs);
   void createCommandBuffer();
-  void sendCommand();
-  void waitFence();
+  void sendCommand(frame &f);
+  void createFence();
+  void endPhase(const char *name, chrono::steady_clock::time_point &start);
+  void collectProfile(frame &f);
+  uint32_t pickQueue();
+  void submitFrame(frame &f);
+  bool pollFrame(uint32_t frameI);
+  Result waitFrame(uint32_t frameI, uint64_t timeout);
+  void waitIdle();
+  void createBatch(batchRes &b, uint32_t jobs);
+  void destroyBatch(batchRes &b);
+  lane &threadLane();
+  void recordLane(lane &l, const uint32_t groups[3]);
 
 public:
   stdEng(const char *appname, uint32_t appvers, const char *engname,
          uint32_t engvers);
+  stdEng(sharedContext *ctx);
 
   void setDebugMode(DebugMode debugMode);
   DebugMode getDebugMode();
   void setWorkgroupSize(uint32_t width, uint32_t height, uint32_t depth);
+  void setLocalSize(uint32_t x, uint32_t y = 1, uint32_t z = 1);
+  void setElementCount(uint32_t x, uint32_t y = 1, uint32_t z = 1);
+  void setSpecConstantBits(uint32_t id, uint32_t bits);
+  /* Set a constant_id of the shader when the pipeline is created, a kernel
+   * tunable that the compiler folds like a literal. May change after build(),
+   * every tuple of values gets its own pipeline.
+   *
+   * @param id The constant_id in the shader
+   * @param value A 32 bit value, use uint32_t for bool
+   */
+  template <typename T> void setSpecConstant(uint32_t id, T value) {
+    static_assert(sizeof(T) == sizeof(uint32_t) &&
+                      is_trivially_copyable<T>::value,
+                  "specialization constants are 32 bit here");
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    this->setSpecConstantBits(id, bits);
+  }
 
   void setPriority(float priority);
+  vector<uint32_t> rankDevices();
+  void setPhysicalDevice(uint32_t index);
+  string getDeviceName();
   void setInputs(vector<vector<void *>> inputs, vector<size_t> size);
   void setOutputs(vector<vector<void *>> outputs, vector<size_t> size);
+  void setStreamSizes(size_t inSize, size_t outSize);
+  vector<size_t> getInputSizes();
+  vector<size_t> getOutputSizes();
   void setBindings(vector<uint32_t> bindings, uint32_t IOSetOffset,
                    uint32_t IOBindingOffset);
+  void setBindings(vector<uint32_t> bindings);
   void setShaderFile(const char *filepath);
+  void setShaderCode(const uint32_t *code, size_t size);
+  // an embedded array, the size comes from its type
+  template <size_t N> void setShaderCode(const uint32_t (&code)[N]) {
+    this->setShaderCode(code, sizeof(code));
+  }
   void setEntryPoint(const char *entryPoint);
   void setWaitFenceFor(uint64_t time);
+  void setPipelineCacheDir(const char *cacheDir);
+
+  void setMemoryBlockSize(DeviceSize blockSize);
+  void setMemoryPlacement(MemoryPlacement placement);
+  void setStagingSize(DeviceSize stagingSize);
+  void setFramesInFlight(uint32_t framesInFlight);
+  void setQueueCount(uint32_t queueCount);
+  void setCommandReuse(bool reuse);
+  void setAddressMode(bool enable);
+  bool supportsAddressMode();
+  bool isAddressMode();
+  recordStats getRecordStats();
+  void setProfiling(bool enable);
+  profileStats getProfileStats();
+  uint32_t getQueueCount();
+
+  void setPushConstantSize(uint32_t size);
+  void setPushConstantData(const void *data, uint32_t size, uint32_t offset);
+  /* Per dispatch scalar parameters, no buffer is mapped or copied. Before
+   * build() the first call declares the range from its size, after build()
+   * it must fit in that range. The next submit() records the current values.
+   *
+   * @param value A struct matching the push_constant block of the shader
+   * @param offset Where the value goes in the block
+   */
+  template <typename T>
+  void setPushConstants(const T &value, uint32_t offset = 0) {
+    static_assert(is_trivially_copyable<T>::value,
+                  "push constants are copied byte by byte");
+    this->setPushConstantData(&value, uint32_t(sizeof(T)), offset);
+  }
 
+  void setAutotuneFile(const char *tuneFile);
+  void setTileConstant(uint32_t id);
+  tuneEntry autotune(uint32_t iterations = 5);
+  bool isAutotuned();
+
+  uint64_t getPipelineCompileTime();
+  pipelineBuildStats createPipelines(const vector<kernelVariant> &kernels,
+                                     uint32_t threads = 0);
+  bool isPipelineCacheWarm();
+
+  /* Writable view over the memory the next submission reads input i from.
+   * Write the data there directly instead of using setInputs, nothing is
+   * copied again by submit(). The view is valid until that submission.
+   */
+  template <typename T> bufView<T> inputSpan(size_t i) {
+    return bufView<T>(static_cast<T *>(this->inputData(i)),
+                      this->insizes.at(i) / sizeof(T));
+  }
+  bool importInput(size_t i, void *hostPtr);
+
+  /* Read only view over output i of the last dispatch, no copy is made.
+   * The view is valid until the next dispatch.
+   */
+  template <typename T> bufView<const T> outputView(size_t i) {
+    return bufView<const T>(
+        static_cast<const T *>(this->outputData(
+            this->lastFrame, this->frames.at(this->lastFrame).serial, i)),
+        this->outsizes.at(i) / sizeof(T));
+  }
+  // Same as above for the outputs of submission s, it waits for s first
+  template <typename T>
+  bufView<const T> outputView(const submission &s, size_t i) {
+    return bufView<const T>(
+        static_cast<const T *>(this->outputData(s.frame, s.serial, i)),
+        this->outsizes.at(i) / sizeof(T));
+  }
+  void readOutput(size_t i, void *dst, size_t size);
+  void readOutput(const submission &s, size_t i, void *dst, size_t size);
   vector<vector<void*>> mapOutputs();
+  memArenaStats getMemoryStats();
+  descCacheStats getDescriptorStats();
+  uint32_t defragmentMemory();
 
+  void build();
+  bool isBuilt();
+  submission submit();
+  void dispatch();
   void run();
 
+  streamStats stream(function<size_t(void *chunk, size_t size)> read,
+                     function<void(const void *chunk, size_t size)> write);
+  streamStats stream(const void *src, size_t srcSize, void *dst,
+                     size_t dstSize);
+  batchStats runBatch(const vector<vector<const void *>> &inputs,
+                      const vector<vector<void *>> &outputs);
+  void runConcurrent(const vector<const void *> &inputs,
+                     const vector<void *> &outputs);
+  uint32_t getLaneCount();
+
   ~stdEng();
 };
 
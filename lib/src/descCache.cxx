@@ -0,0 +1,178 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3.0
+// for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <algorithm>
+#include <chrono>
+#include <descCache.hxx>
+
+using namespace std;
+using namespace vkmincomp;
+
+/* @param setLays The layout of every set, set i is bound at index i
+ * @param bindings The number of storage buffer bindings of each set
+ * @param slots The set and binding of every buffer given to get()
+ * @param groupsPerPool Groups the first descriptor pool holds, the pools
+ * made when they run out hold twice as many as the one before
+ * @param useTemplates Write with descriptor update templates, Vulkan 1.1
+ */
+void descCache::init(Device dev, const vector<DescriptorSetLayout> &setLays,
+                     const vector<uint32_t> &bindings,
+                     const vector<pair<uint32_t, uint32_t>> &slots,
+                     uint32_t groupsPerPool, bool useTemplates) {
+  this->dev = dev;
+  this->setLays = setLays;
+  this->slots = slots;
+  this->groupsPerPool = max(groupsPerPool, 1u);
+  this->sumBind = 0;
+  for (uint32_t setI = 0; setI < bindings.size(); ++setI) {
+    this->sumBind += bindings.at(setI);
+    if (!useTemplates)
+      continue;
+    /* the buffer infos are one array, every template reads the buffers of
+     * its set at their place in it
+     */
+    vector<DescriptorUpdateTemplateEntry> entries;
+    for (uint32_t p = 0; p < slots.size(); ++p)
+      if (slots.at(p).first == setI)
+        entries.push_back(DescriptorUpdateTemplateEntry(
+            slots.at(p).second, 0, 1, DescriptorType::eStorageBuffer,
+            p * sizeof(DescriptorBufferInfo), sizeof(DescriptorBufferInfo)));
+    this->templates.push_back(
+        entries.empty()
+            ? DescriptorUpdateTemplate()
+            : this->dev.createDescriptorUpdateTemplate(
+                  DescriptorUpdateTemplateCreateInfo(
+                      DescriptorUpdateTemplateCreateFlags(), entries,
+                      DescriptorUpdateTemplateType::eDescriptorSet,
+                      setLays.at(setI))));
+  }
+}
+
+/* a pool that lets single groups be freed, twice the size of the one before
+ * so a batch of many jobs needs few pools
+ */
+void descCache::addPool() {
+  uint32_t groups = this->groupsPerPool;
+  if (!this->poolSizes.empty())
+    groups = min(this->poolSizes.back(), 1u << 20) * 2;
+  DescriptorPoolSize descPoolSize(DescriptorType::eStorageBuffer,
+                                  max(this->sumBind, 1u) * groups);
+  DescriptorPoolCreateInfo descPoolInfo(
+      DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+      uint32_t(this->setLays.size()) * groups, descPoolSize);
+  this->pools.push_back(this->dev.createDescriptorPool(descPoolInfo));
+  this->poolLeft.push_back(groups);
+  this->poolSizes.push_back(groups);
+}
+
+/* Point the sets of a group at the buffers, buffer p of descBuffInfos goes to
+ * slots[p]. Without templates, or with fewer buffers than slots, it goes
+ * through vkUpdateDescriptorSets.
+ */
+void descCache::write(const DescriptorSet *sets,
+                      const vector<DescriptorBufferInfo> &descBuffInfos) {
+  if (!this->templates.empty() && descBuffInfos.size() >= this->slots.size()) {
+    for (uint32_t setI = 0; setI < this->templates.size(); ++setI)
+      if (this->templates.at(setI))
+        this->dev.updateDescriptorSetWithTemplate(
+            sets[setI], this->templates.at(setI), descBuffInfos.data());
+    return;
+  }
+  vector<WriteDescriptorSet> writeDescSets;
+  for (uint32_t p = 0; p < this->slots.size() && p < descBuffInfos.size(); ++p)
+    if (this->slots.at(p).first < this->setLays.size())
+      writeDescSets.push_back(WriteDescriptorSet(
+          sets[this->slots.at(p).first], this->slots.at(p).second, 0, 1,
+          DescriptorType::eStorageBuffer, nullptr, &descBuffInfos.at(p)));
+  this->dev.updateDescriptorSets(writeDescSets, nullptr);
+}
+
+// the group for these buffers, one set per set layout
+vector<DescriptorSet>
+descCache::get(const vector<DescriptorBufferInfo> &descBuffInfos) {
+  lock_guard<mutex> guard(this->lock);
+  vector<tuple<Buffer, DeviceSize, DeviceSize>> key;
+  for (const DescriptorBufferInfo &info : descBuffInfos)
+    key.push_back(make_tuple(info.buffer, info.offset, info.range));
+  auto found = this->entries.find(key);
+  if (found != this->entries.end()) {
+    ++this->stats.hits;
+    return found->second.sets;
+  }
+
+  ++this->stats.misses;
+  group g;
+  if (!this->freeGroups.empty()) {
+    g = this->freeGroups.back();
+    this->freeGroups.pop_back();
+    ++this->stats.recycled;
+  } else {
+    g.pool = 0;
+    while (g.pool < this->pools.size() && !this->poolLeft.at(g.pool))
+      ++g.pool;
+    if (g.pool == this->pools.size())
+      this->addPool();
+    g.sets = this->dev.allocateDescriptorSets(
+        DescriptorSetAllocateInfo(this->pools.at(g.pool), this->setLays));
+    --this->poolLeft.at(g.pool);
+  }
+  auto start = chrono::steady_clock::now();
+  this->write(g.sets.data(), descBuffInfos);
+  this->stats.updateNanoseconds += chrono::duration_cast<chrono::nanoseconds>(
+                                       chrono::steady_clock::now() - start)
+                                       .count();
+  this->entries[key] = g;
+  return g.sets;
+}
+
+/* Forget every group pointing at buff, before it is destroyed. Nothing may
+ * still use those sets.
+ */
+void descCache::evict(Buffer buff) {
+  lock_guard<mutex> guard(this->lock);
+  for (auto it = this->entries.begin(); it != this->entries.end();) {
+    bool uses = false;
+    for (auto &b : it->first)
+      uses = uses || std::get<0>(b) == buff;
+    if (uses) {
+      this->freeGroups.push_back(it->second);
+      it = this->entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// give the groups on the free list back to their pools
+void descCache::trim() {
+  lock_guard<mutex> guard(this->lock);
+  for (group &g : this->freeGroups) {
+    this->dev.freeDescriptorSets(this->pools.at(g.pool), g.sets);
+    ++this->poolLeft.at(g.pool);
+  }
+  this->freeGroups.clear();
+}
+
+descCacheStats descCache::getStats() {
+  lock_guard<mutex> guard(this->lock);
+  descCacheStats stats = this->stats;
+  uint64_t lookups = stats.hits + stats.misses;
+  if (lookups)
+    stats.hitRate = double(stats.hits) / lookups;
+  return stats;
+}
+
+// destroying the pools frees every set
+void descCache::destroy() {
+  for (DescriptorUpdateTemplate descTemplate : this->templates)
+    if (descTemplate)
+      this->dev.destroyDescriptorUpdateTemplate(descTemplate);
+  for (DescriptorPool pool : this->pools)
+    this->dev.destroyDescriptorPool(pool);
+  this->templates.clear();
+  this->pools.clear();
+  this->poolLeft.clear();
+  this->poolSizes.clear();
+  this->entries.clear();
+  this->freeGroups.clear();
+}
@@ -0,0 +1,45 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3.0
+// for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <fencePool.hxx>
+
+using namespace std;
+using namespace vkmincomp;
+
+/* @param count Fences created up front, usually one per frame in flight. The
+ * pool grows when more are acquired at once.
+ */
+void fencePool::init(Device dev, uint32_t count) {
+  this->dev = dev;
+  for (uint32_t i = 0; i < count; ++i)
+    this->freeFences.push_back(this->dev.createFence(FenceCreateInfo()));
+  this->created = count;
+}
+
+// an unsignaled fence, owned by the caller until release()
+Fence fencePool::acquire() {
+  if (this->freeFences.empty()) {
+    ++this->created;
+    return this->dev.createFence(FenceCreateInfo());
+  }
+  Fence fence = this->freeFences.back();
+  this->freeFences.pop_back();
+  return fence;
+}
+
+// the fence must be signaled or never submitted, it is reset here
+void fencePool::release(Fence fence) {
+  this->dev.resetFences({fence});
+  this->freeFences.push_back(fence);
+}
+
+// the number of fences created so far
+uint32_t fencePool::size() { return this->created; }
+
+// every fence must have been released
+void fencePool::destroy() {
+  for (Fence fence : this->freeFences)
+    this->dev.destroyFence(fence);
+  this->freeFences.clear();
+  this->created = 0;
+}
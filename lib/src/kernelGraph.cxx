@@ -0,0 +1,397 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3.0
+// for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <vkmincomp.hxx>
+
+using namespace std;
+using namespace vkmincomp;
+
+// the engine must outlive the graph
+kernelGraph::kernelGraph(stdEng &eng) : eng(eng) {}
+
+/* @param size The size of the buffer in byte
+ * @param use Who reads and writes it, see GraphBuffer
+ * @return the index of the buffer for addKernel, inputData and readOutput
+ */
+uint32_t kernelGraph::addBuffer(DeviceSize size, GraphBuffer use) {
+  if (this->built) {
+    cout << "Graph already built!" << endl;
+    exit(EXIT_FAILURE);
+  }
+  graphBuff buff;
+  buff.use = use;
+  buff.size = size;
+  this->buffs.push_back(buff);
+  return uint32_t(this->buffs.size() - 1);
+}
+
+/* Add a kernel from a SPIR-V file, read by build()
+ *
+ * @param filepath The path to the SPIR-V shader file
+ * @param entryPoint The name of the function as the entry point in the shader
+ * @param reads Buffers the kernel reads, bound from binding 0 of set 0
+ * @param writes Buffers the kernel writes, bound after the reads
+ * @param width, height, depth The number of workgroups
+ * @return the index of the kernel
+ */
+uint32_t kernelGraph::addKernel(const char *filepath, const char *entryPoint,
+                                vector<uint32_t> reads, vector<uint32_t> writes,
+                                uint32_t width, uint32_t height,
+                                uint32_t depth) {
+  uint32_t k = this->addKernel(static_cast<const uint32_t *>(nullptr), 0,
+                               entryPoint, reads, writes, width, height, depth);
+  this->kernels.at(k).filepath = filepath;
+  return k;
+}
+
+/* Add a kernel, the order of the calls is the order the results must respect
+ *
+ * @param code The words of the module, embedded at build time, they must stay
+ * valid until build()
+ * @param size The size of the code in bytes
+ * @param entryPoint The name of the function as the entry point in the shader
+ * @param reads Buffers the kernel reads, bound from binding 0 of set 0
+ * @param writes Buffers the kernel writes, bound after the reads
+ * @param width, height, depth The number of workgroups
+ * @return the index of the kernel
+ */
+uint32_t kernelGraph::addKernel(const uint32_t *code, size_t size,
+                                const char *entryPoint, vector<uint32_t> reads,
+                                vector<uint32_t> writes, uint32_t width,
+                                uint32_t height, uint32_t depth) {
+  if (this->built) {
+    cout << "Graph already built!" << endl;
+    exit(EXIT_FAILURE);
+  }
+  for (uint32_t b : reads)
+    if (b >= this->buffs.size()) {
+      cout << "Kernel reads an unknown buffer " << b << endl;
+      exit(EXIT_FAILURE);
+    }
+  for (uint32_t b : writes)
+    if (b >= this->buffs.size()) {
+      cout << "Kernel writes an unknown buffer " << b << endl;
+      exit(EXIT_FAILURE);
+    }
+  graphKernel kernel;
+  kernel.code = code;
+  kernel.codeSize = size;
+  kernel.entryPoint = entryPoint;
+  kernel.reads = reads;
+  kernel.writes = writes;
+  kernel.width = width;
+  kernel.height = height;
+  kernel.depth = depth;
+  this->kernels.push_back(kernel);
+  return uint32_t(this->kernels.size() - 1);
+}
+
+// metode private
+/* Inputs and outputs are host visible, outputs preferably cached.
+ * Intermediates prefer DEVICE_LOCAL, the host never sees them.
+ */
+void kernelGraph::allocateBuffers() {
+  memArena &arena = this->eng.arena;
+  lock_guard<mutex> lock(this->eng.arenaMutex);
+  for (graphBuff &b : this->buffs) {
+    b.buff = this->dev.createBuffer(
+        BufferCreateInfo(BufferCreateFlags(), b.size,
+                         BufferUsageFlagBits::eStorageBuffer,
+                         SharingMode::eExclusive));
+    MemoryRequirements memReq = this->dev.getBufferMemoryRequirements(b.buff);
+    uint32_t typeIndex = uint32_t(~0);
+    if (b.use == GraphBuffer::GRAPH_INTERMEDIATE)
+      typeIndex = arena.findMemoryType(memReq.memoryTypeBits,
+                                       MemoryPropertyFlags(),
+                                       MemoryPropertyFlagBits::eDeviceLocal);
+    if (b.use == GraphBuffer::GRAPH_OUTPUT)
+      typeIndex = arena.findMemoryType(
+          memReq.memoryTypeBits, MemoryPropertyFlagBits::eHostVisible |
+                                     MemoryPropertyFlagBits::eHostCached,
+          MemoryPropertyFlagBits::eHostCoherent);
+    if (typeIndex == uint32_t(~0))
+      typeIndex = arena.findMemoryType(
+          memReq.memoryTypeBits, MemoryPropertyFlagBits::eHostVisible |
+                                     MemoryPropertyFlagBits::eHostCoherent);
+    if (typeIndex == uint32_t(~0)) {
+      cout << "No heap found for a graph buffer" << endl;
+      exit(EXIT_FAILURE);
+    }
+    b.coherent = bool(this->eng.physdev.getMemoryProperties()
+                          .memoryTypes[typeIndex]
+                          .propertyFlags &
+                      MemoryPropertyFlagBits::eHostCoherent);
+    if (!b.coherent) {
+      memReq.alignment = max(memReq.alignment, this->eng.atomSize);
+      memReq.size = (memReq.size + this->eng.atomSize - 1) /
+                    this->eng.atomSize * this->eng.atomSize;
+    }
+    b.alloc = arena.allocate(memReq, typeIndex);
+    this->dev.bindBufferMemory(b.buff, b.alloc.mem, b.alloc.offset);
+  }
+}
+
+// shader module, layouts, pipeline and descriptor set of every kernel
+void kernelGraph::createPipelines() {
+  uint32_t sumBind = 0;
+  for (graphKernel &k : this->kernels)
+    sumBind += uint32_t(k.reads.size() + k.writes.size());
+  DescriptorPoolSize descPoolSize(DescriptorType::eStorageBuffer, sumBind);
+  this->descPool = this->dev.createDescriptorPool(DescriptorPoolCreateInfo(
+      DescriptorPoolCreateFlags(), uint32_t(this->kernels.size()),
+      descPoolSize));
+
+  for (graphKernel &k : this->kernels) {
+    vector<char> shaderRaw;
+    if (k.filepath) {
+      ifstream shaderFile(k.filepath, ios::ate | ios::binary);
+      if (!shaderFile) {
+        cout << "Failed to open shader file " << k.filepath << endl;
+        exit(EXIT_FAILURE);
+      }
+      shaderRaw.resize(size_t(shaderFile.tellg()));
+      shaderFile.seekg(0);
+      shaderFile.read(shaderRaw.data(), shaderRaw.size());
+      k.code = reinterpret_cast<const uint32_t *>(shaderRaw.data());
+      k.codeSize = shaderRaw.size();
+    }
+    // the engine and the other kernels may use the same code
+    k.shadMod = shaderCache::acquire(this->dev, k.code, k.codeSize,
+                                     hashBytes(k.code, k.codeSize));
+    if (k.filepath)
+      k.code = nullptr;
+
+    vector<uint32_t> bound = k.reads;
+    bound.insert(bound.end(), k.writes.begin(), k.writes.end());
+    vector<DescriptorSetLayoutBinding> descSetLayBinds;
+    for (uint32_t i = 0; i < bound.size(); ++i)
+      descSetLayBinds.push_back(DescriptorSetLayoutBinding(
+          i, DescriptorType::eStorageBuffer, 1, ShaderStageFlagBits::eCompute));
+    k.descSetLay = this->dev.createDescriptorSetLayout(
+        DescriptorSetLayoutCreateInfo(DescriptorSetLayoutCreateFlags(),
+                                      descSetLayBinds));
+    k.pipeLay = this->dev.createPipelineLayout(
+        PipelineLayoutCreateInfo(PipelineLayoutCreateFlags(), k.descSetLay));
+    ResultValue res = this->dev.createComputePipeline(
+        this->eng.pipeCache.get(),
+        ComputePipelineCreateInfo(
+            PipelineCreateFlags(),
+            PipelineShaderStageCreateInfo(PipelineShaderStageCreateFlags(),
+                                          ShaderStageFlagBits::eCompute,
+                                          k.shadMod, k.entryPoint),
+            k.pipeLay));
+    if (res.result != Result::eSuccess) {
+      cout << "Failed to create pipeline of "
+           << (k.filepath ? k.filepath : k.entryPoint) << endl;
+      exit(EXIT_FAILURE);
+    }
+    k.pipe = res.value;
+
+    k.descSet = this->dev
+                    .allocateDescriptorSets(DescriptorSetAllocateInfo(
+                        this->descPool, 1, &k.descSetLay))
+                    .front();
+    vector<DescriptorBufferInfo> descBuffInfos;
+    for (uint32_t b : bound)
+      descBuffInfos.push_back(
+          DescriptorBufferInfo(this->buffs.at(b).buff, 0, this->buffs.at(b).size));
+    vector<WriteDescriptorSet> writeDescSets;
+    for (uint32_t i = 0; i < bound.size(); ++i)
+      writeDescSets.push_back(WriteDescriptorSet(
+          k.descSet, i, 0, 1, DescriptorType::eStorageBuffer, nullptr,
+          &descBuffInfos.at(i)));
+    this->dev.updateDescriptorSets(writeDescSets, nullptr);
+  }
+  this->eng.pipeCache.save();
+}
+
+static bool touches(const vector<uint32_t> &buffs, uint32_t buff) {
+  return find(buffs.begin(), buffs.end(), buff) != buffs.end();
+}
+
+/* a kernel goes one level after the last earlier kernel it conflicts with:
+ * read after write, write after write or write after read of one buffer
+ */
+void kernelGraph::schedule() {
+  this->levelCount = 0;
+  for (size_t k = 0; k < this->kernels.size(); ++k) {
+    graphKernel &later = this->kernels[k];
+    later.level = 0;
+    for (size_t e = 0; e < k; ++e) {
+      graphKernel &earlier = this->kernels[e];
+      bool conflict = false;
+      for (uint32_t b : later.reads)
+        conflict |= touches(earlier.writes, b);
+      for (uint32_t b : later.writes)
+        conflict |= touches(earlier.writes, b) || touches(earlier.reads, b);
+      if (conflict)
+        later.level = max(later.level, earlier.level + 1);
+    }
+    this->levelCount = max(this->levelCount, later.level + 1);
+  }
+}
+
+/* Record the levels in order. Only the buffers a level depends on get a
+ * barrier, a write after read only needs the execution dependency.
+ */
+void kernelGraph::record() {
+  this->cmdPool = this->dev.createCommandPool(
+      CommandPoolCreateInfo(CommandPoolCreateFlags(), this->eng.queueFamIndex));
+  this->cmdBuff = this->dev
+                      .allocateCommandBuffers(CommandBufferAllocateInfo(
+                          this->cmdPool, CommandBufferLevel::ePrimary, 1))
+                      .front();
+  // recorded once and submitted by every run()
+  this->cmdBuff.begin(CommandBufferBeginInfo());
+  this->barrierCount = 0;
+  for (uint32_t level = 0; level < this->levelCount; ++level) {
+    // buffer -> access of the earlier and the later kernels
+    map<uint32_t, pair<AccessFlags, AccessFlags>> hazards;
+    for (graphKernel &later : this->kernels) {
+      if (later.level != level)
+        continue;
+      for (graphKernel &earlier : this->kernels) {
+        if (earlier.level >= level)
+          continue;
+        for (uint32_t b : later.reads)
+          if (touches(earlier.writes, b)) {
+            hazards[b].first |= AccessFlagBits::eShaderWrite;
+            hazards[b].second |= AccessFlagBits::eShaderRead;
+          }
+        for (uint32_t b : later.writes) {
+          if (touches(earlier.writes, b)) {
+            hazards[b].first |= AccessFlagBits::eShaderWrite;
+            hazards[b].second |= AccessFlagBits::eShaderWrite;
+          } else if (touches(earlier.reads, b)) {
+            hazards[b].second |= AccessFlagBits::eShaderWrite;
+          }
+        }
+      }
+    }
+    if (!hazards.empty()) {
+      vector<BufferMemoryBarrier> barriers;
+      for (auto &hazard : hazards)
+        barriers.push_back(BufferMemoryBarrier(
+            hazard.second.first, hazard.second.second, VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED, this->buffs.at(hazard.first).buff, 0,
+            VK_WHOLE_SIZE));
+      this->cmdBuff.pipelineBarrier(PipelineStageFlagBits::eComputeShader,
+                                    PipelineStageFlagBits::eComputeShader, {},
+                                    nullptr, barriers, nullptr);
+      ++this->barrierCount;
+    }
+    for (graphKernel &k : this->kernels) {
+      if (k.level != level)
+        continue;
+      this->cmdBuff.bindPipeline(PipelineBindPoint::eCompute, k.pipe);
+      this->cmdBuff.bindDescriptorSets(PipelineBindPoint::eCompute, k.pipeLay,
+                                       0, k.descSet, {});
+      this->cmdBuff.dispatch(k.width, k.height, k.depth);
+    }
+  }
+  vector<BufferMemoryBarrier> toHost;
+  for (graphBuff &b : this->buffs)
+    if (b.use == GraphBuffer::GRAPH_OUTPUT)
+      toHost.push_back(BufferMemoryBarrier(
+          AccessFlagBits::eShaderWrite, AccessFlagBits::eHostRead,
+          VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, b.buff, 0,
+          VK_WHOLE_SIZE));
+  if (!toHost.empty())
+    this->cmdBuff.pipelineBarrier(PipelineStageFlagBits::eComputeShader,
+                                  PipelineStageFlagBits::eHost, {}, nullptr,
+                                  toHost, nullptr);
+  this->cmdBuff.end();
+}
+// akhir dari metode private
+
+// Allocate the buffers, create the pipelines and record the command buffer
+void kernelGraph::build() {
+  if (this->built) {
+    cout << "Graph already built!" << endl;
+    return;
+  }
+  if (this->kernels.empty()) {
+    cout << "No kernel has been added!" << endl;
+    exit(EXIT_FAILURE);
+  }
+  if (!this->eng.built)
+    this->eng.build();
+  this->dev = this->eng.dev;
+  this->allocateBuffers();
+  this->createPipelines();
+  this->schedule();
+  this->record();
+  this->built = true;
+}
+
+// one submit for every kernel, wait for it
+void kernelGraph::run() {
+  if (!this->built)
+    this->build();
+  Fence fence = this->eng.fences.acquire();
+  this->eng.ctx->submits.submit(
+      this->eng.queue, SubmitInfo(0, nullptr, nullptr, 1, &this->cmdBuff),
+      fence);
+  this->dev.waitForFences({fence}, true, uint64_t(-1));
+  this->eng.fences.release(fence);
+}
+
+// host address of a GRAPH_INPUT buffer, write the data there before run()
+void *kernelGraph::inputData(uint32_t buff) {
+  if (!this->built)
+    this->build();
+  graphBuff &b = this->buffs.at(buff);
+  if (b.use != GraphBuffer::GRAPH_INPUT) {
+    cout << "Buffer " << buff << " is not a graph input!" << endl;
+    exit(EXIT_FAILURE);
+  }
+  return b.alloc.mapped;
+}
+
+/* Copy a GRAPH_OUTPUT buffer of the last run()
+ *
+ * @param buff The index of the buffer
+ * @param dst Where to copy to
+ * @param size The number of bytes to copy, at most the buffer size
+ */
+void kernelGraph::readOutput(uint32_t buff, void *dst, size_t size) {
+  graphBuff &b = this->buffs.at(buff);
+  if (!this->built || b.use != GraphBuffer::GRAPH_OUTPUT) {
+    cout << "Buffer " << buff << " is not a graph output!" << endl;
+    exit(EXIT_FAILURE);
+  }
+  if (!b.coherent)
+    this->dev.invalidateMappedMemoryRanges(
+        MappedMemoryRange(b.alloc.mem, b.alloc.offset, b.alloc.size));
+  memcpy(dst, b.alloc.mapped, min(size, size_t(b.size)));
+}
+
+// number of levels, kernels on one level run without barriers between them
+uint32_t kernelGraph::getLevelCount() { return this->levelCount; }
+
+// number of pipelineBarrier recorded between the levels
+uint32_t kernelGraph::getBarrierCount() { return this->barrierCount; }
+
+// destructor
+kernelGraph::~kernelGraph() {
+  if (!this->built)
+    return;
+  this->dev.destroyCommandPool(this->cmdPool);
+  for (graphKernel &k : this->kernels) {
+    this->dev.destroyPipeline(k.pipe);
+    this->dev.destroyPipelineLayout(k.pipeLay);
+    this->dev.destroyDescriptorSetLayout(k.descSetLay);
+    shaderCache::release(this->dev, k.shadMod);
+  }
+  this->dev.destroyDescriptorPool(this->descPool);
+  lock_guard<mutex> lock(this->eng.arenaMutex);
+  for (graphBuff &b : this->buffs) {
+    this->dev.destroyBuffer(b.buff);
+    this->eng.arena.free(b.alloc);
+  }
+}
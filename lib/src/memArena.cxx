@@ -0,0 +1,328 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3.0
+// for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <algorithm>
+#include <memArena.hxx>
+
+using namespace std;
+using namespace vkmincomp;
+
+static DeviceSize alignUp(DeviceSize value, DeviceSize alignment) {
+  return alignment > 1 ? (value + alignment - 1) / alignment * alignment
+                       : value;
+}
+
+/* @param physdev The physical device, for the memory types and limits
+ * @param dev The logical device where the blocks are allocated
+ */
+void memArena::init(PhysicalDevice physdev, Device dev) {
+  this->dev = dev;
+  this->memProps = physdev.getMemoryProperties();
+  this->granularity = physdev.getProperties().limits.bufferImageGranularity;
+}
+
+/* @param blockSize The size of every new block, allocations bigger than this
+ * get a block of their own size
+ */
+void memArena::setBlockSize(DeviceSize blockSize) {
+  this->blockSize = blockSize;
+}
+
+/* @param allocFlags Flags of every new block, eDeviceAddress for buffers
+ * whose address is taken
+ */
+void memArena::setAllocateFlags(MemoryAllocateFlags allocFlags) {
+  this->allocFlags = allocFlags;
+}
+
+/* Find a memory type from the typeBits of a MemoryRequirements
+ *
+ * @param required Flags the memory type must have
+ * @param preferred Flags that are nice to have, a type with both wins
+ * @return the memory type index or ~0 when nothing matches
+ */
+uint32_t memArena::findMemoryType(uint32_t typeBits,
+                                  MemoryPropertyFlags required,
+                                  MemoryPropertyFlags preferred) {
+  uint32_t found = uint32_t(~0);
+  for (uint32_t i = 0; i < this->memProps.memoryTypeCount; ++i) {
+    if (!(typeBits & (1u << i)))
+      continue;
+    MemoryPropertyFlags flags = this->memProps.memoryTypes[i].propertyFlags;
+    if ((flags & required) != required)
+      continue;
+    if ((flags & preferred) == preferred)
+      return i;
+    if (found == uint32_t(~0))
+      found = i;
+  }
+  return found;
+}
+
+/* best fit search in one block
+ *
+ * A linear resource and a non linear one must not share a page of
+ * bufferImageGranularity, so the offset is pushed to the next page when the
+ * previous neighbour differs and the range is skipped when the next one does.
+ * Only offsets below limit are taken, so defragment() finds a lower range
+ * even when the best fit of the block is above it.
+ */
+bool memArena::place(block &blk, DeviceSize size, DeviceSize alignment,
+                     bool linear, DeviceSize &offset, size_t &rangeI,
+                     DeviceSize limit) {
+  DeviceSize g = this->granularity;
+  DeviceSize bestSize = DeviceSize(~0);
+  for (size_t i = 0; i < blk.freeRanges.size(); ++i) {
+    const range &r = blk.freeRanges[i];
+    if (r.size < size || r.size >= bestSize)
+      continue;
+    DeviceSize o = alignUp(r.offset, alignment);
+    auto next = blk.allocs.lower_bound(r.offset + r.size);
+    auto prev = blk.allocs.lower_bound(r.offset);
+    if (g > 1 && prev != blk.allocs.begin()) {
+      --prev;
+      if (prev->second.linear != linear &&
+          (prev->first + prev->second.size - 1) / g == o / g)
+        o = alignUp(o, g);
+    }
+    if (o + size > r.offset + r.size || o >= limit)
+      continue;
+    if (g > 1 && next != blk.allocs.end() && next->second.linear != linear &&
+        (o + size - 1) / g == next->first / g)
+      continue;
+    offset = o;
+    rangeI = i;
+    bestSize = r.size;
+  }
+  return bestSize != DeviceSize(~0);
+}
+
+// split the free range around the new allocation
+void memArena::take(block &blk, size_t rangeI, DeviceSize offset,
+                    const used &info) {
+  DeviceSize size = info.size;
+  range r = blk.freeRanges[rangeI];
+  blk.freeRanges.erase(blk.freeRanges.begin() + rangeI);
+  if (offset + size < r.offset + r.size)
+    blk.freeRanges.insert(blk.freeRanges.begin() + rangeI,
+                          {offset + size, r.offset + r.size - offset - size});
+  if (offset > r.offset)
+    blk.freeRanges.insert(blk.freeRanges.begin() + rangeI,
+                          {r.offset, offset - r.offset});
+  blk.allocs[offset] = info;
+}
+
+// a new block, reusing the slot of a trimmed one so indices stay stable
+uint32_t memArena::createBlock(uint32_t typeIndex, DeviceSize minSize) {
+  const MemoryHeap &heap =
+      this->memProps.memoryHeaps[this->memProps.memoryTypes[typeIndex].heapIndex];
+  DeviceSize size = max(this->blockSize, minSize);
+  if (size > heap.size / 4)
+    size = max(heap.size / 4, minSize);
+  MemoryAllocateFlagsInfo flagsInfo(this->allocFlags);
+  const void *next = this->allocFlags ? &flagsInfo : nullptr;
+  DeviceMemory mem;
+  try {
+    mem = this->dev.allocateMemory(MemoryAllocateInfo(size, typeIndex, next));
+  } catch (SystemError &) {
+    if (size == minSize)
+      throw;
+    size = minSize;
+    mem = this->dev.allocateMemory(MemoryAllocateInfo(size, typeIndex, next));
+  }
+  uint32_t index = 0;
+  while (index < this->blocks.size() && this->blocks[index].mem)
+    ++index;
+  if (index == this->blocks.size())
+    this->blocks.push_back({});
+  block &blk = this->blocks[index];
+  blk.mem = mem;
+  blk.mapped = nullptr;
+  if (this->memProps.memoryTypes[typeIndex].propertyFlags &
+      MemoryPropertyFlagBits::eHostVisible)
+    blk.mapped = static_cast<char *>(this->dev.mapMemory(mem, 0, size));
+  blk.typeIndex = typeIndex;
+  blk.size = size;
+  blk.freeRanges = {{0, size}};
+  blk.allocs.clear();
+  return index;
+}
+
+/* allocate below (lastBlock, lastOffset), used by defragment(). Without a
+ * limit a new block is created when nothing fits.
+ */
+memAlloc memArena::allocateFrom(const MemoryRequirements &memReq,
+                                uint32_t typeIndex, bool linear,
+                                uint32_t lastBlock, DeviceSize lastOffset) {
+  memAlloc alloc;
+  DeviceSize offset;
+  size_t rangeI;
+  uint32_t found = uint32_t(~0);
+  for (uint32_t i = 0; i < this->blocks.size() && i <= lastBlock; ++i) {
+    block &blk = this->blocks[i];
+    if (!blk.mem || blk.typeIndex != typeIndex)
+      continue;
+    if (this->place(blk, memReq.size, memReq.alignment, linear, offset,
+                    rangeI, i < lastBlock ? DeviceSize(~0) : lastOffset)) {
+      found = i;
+      break;
+    }
+  }
+  if (found == uint32_t(~0)) {
+    if (lastBlock != uint32_t(~0))
+      return alloc;
+    found = this->createBlock(typeIndex,
+                              alignUp(memReq.size, this->granularity));
+    this->place(this->blocks[found], memReq.size, memReq.alignment, linear,
+                offset, rangeI);
+  }
+  this->take(this->blocks[found], rangeI, offset,
+             {memReq.size, memReq.alignment, linear});
+  alloc.mem = this->blocks[found].mem;
+  alloc.offset = offset;
+  if (this->blocks[found].mapped)
+    alloc.mapped = this->blocks[found].mapped + offset;
+  alloc.size = memReq.size;
+  alloc.typeIndex = typeIndex;
+  alloc.block = found;
+  return alloc;
+}
+
+/* Sub allocate a range for a resource
+ *
+ * @param memReq The requirements of the buffer from getBufferMemoryRequirements
+ * @param typeIndex The memory type, see findMemoryType()
+ * @param linear false for optimal tiling images, buffers are always linear
+ */
+memAlloc memArena::allocate(const MemoryRequirements &memReq,
+                            uint32_t typeIndex, bool linear) {
+  return this->allocateFrom(memReq, typeIndex, linear, uint32_t(~0), 0);
+}
+
+// give the range back and merge it with its free neighbours
+void memArena::free(const memAlloc &alloc) {
+  if (!alloc.mem || alloc.block >= this->blocks.size())
+    return;
+  block &blk = this->blocks[alloc.block];
+  if (blk.mem != alloc.mem || !blk.allocs.erase(alloc.offset))
+    return;
+  auto it = lower_bound(
+      blk.freeRanges.begin(), blk.freeRanges.end(), alloc.offset,
+      [](const range &r, DeviceSize offset) { return r.offset < offset; });
+  it = blk.freeRanges.insert(it, {alloc.offset, alloc.size});
+  auto next = it + 1;
+  if (next != blk.freeRanges.end() && it->offset + it->size == next->offset) {
+    it->size += next->size;
+    blk.freeRanges.erase(next);
+  }
+  if (it != blk.freeRanges.begin()) {
+    auto prev = it - 1;
+    if (prev->offset + prev->size == it->offset) {
+      prev->size += it->size;
+      blk.freeRanges.erase(it);
+    }
+  }
+}
+
+/* Move allocations to lower blocks and offsets so the tail blocks become
+ * empty and free space merges.
+ *
+ * The new range is reserved while the old one is still live, so they never
+ * overlap. The old ranges are released when the pass ends, call it again to
+ * compact further. Blocks are not freed here because the moves may still be
+ * pending on the gpu, call trim() after they completed.
+ *
+ * @param move Called for every move, it must copy the content and rebind the
+ * resource from the old range to the new one. It returns false for a range it
+ * does not own or can not move, the allocation then stays where it is.
+ * @return the number of moved allocations
+ */
+uint32_t memArena::defragment(
+    function<bool(const memAlloc &from, const memAlloc &to)> move) {
+  struct candidate {
+    memAlloc alloc;
+    used info;
+  };
+  vector<candidate> candidates;
+  for (uint32_t i = uint32_t(this->blocks.size()); i-- > 0;) {
+    block &blk = this->blocks[i];
+    if (!blk.mem)
+      continue;
+    for (auto it = blk.allocs.rbegin(); it != blk.allocs.rend(); ++it) {
+      memAlloc alloc;
+      alloc.mem = blk.mem;
+      alloc.offset = it->first;
+      if (blk.mapped)
+        alloc.mapped = blk.mapped + it->first;
+      alloc.size = it->second.size;
+      alloc.typeIndex = blk.typeIndex;
+      alloc.block = i;
+      candidates.push_back({alloc, it->second});
+    }
+  }
+  vector<memAlloc> moved;
+  for (candidate &c : candidates) {
+    MemoryRequirements memReq;
+    memReq.size = c.alloc.size;
+    memReq.alignment = c.info.alignment;
+    memAlloc to = this->allocateFrom(memReq, c.alloc.typeIndex,
+                                     c.info.linear, c.alloc.block,
+                                     c.alloc.offset);
+    if (!to.mem)
+      continue;
+    if (!move(c.alloc, to)) {
+      this->free(to);
+      continue;
+    }
+    moved.push_back(c.alloc);
+  }
+  for (const memAlloc &alloc : moved)
+    this->free(alloc);
+  return uint32_t(moved.size());
+}
+
+// free the blocks without any allocation
+void memArena::trim() {
+  for (block &blk : this->blocks) {
+    if (!blk.mem || !blk.allocs.empty())
+      continue;
+    if (blk.mapped)
+      this->dev.unmapMemory(blk.mem);
+    this->dev.freeMemory(blk.mem);
+    blk.mem = nullptr;
+    blk.freeRanges.clear();
+  }
+}
+
+memArenaStats memArena::getStats() {
+  memArenaStats stats;
+  DeviceSize totalFree = 0;
+  for (const block &blk : this->blocks) {
+    if (!blk.mem)
+      continue;
+    stats.blockCount++;
+    stats.reserved += blk.size;
+    stats.allocationCount += uint32_t(blk.allocs.size());
+    for (const auto &alloc : blk.allocs)
+      stats.used += alloc.second.size;
+    stats.freeRangeCount += uint32_t(blk.freeRanges.size());
+    for (const range &r : blk.freeRanges) {
+      totalFree += r.size;
+      stats.largestFreeRange = max(stats.largestFreeRange, r.size);
+    }
+  }
+  if (totalFree)
+    stats.fragmentation = 1.0 - double(stats.largestFreeRange) / totalFree;
+  return stats;
+}
+
+void memArena::destroy() {
+  for (block &blk : this->blocks) {
+    if (!blk.mem)
+      continue;
+    if (blk.mapped)
+      this->dev.unmapMemory(blk.mem);
+    this->dev.freeMemory(blk.mem);
+  }
+  this->blocks.clear();
+}
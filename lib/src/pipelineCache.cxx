@@ -0,0 +1,128 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3.0
+// for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <cstdio>
+#include <filesystem>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <pipelineCache.hxx>
+#include <random>
+#include <sstream>
+
+using namespace std;
+using namespace vkmincomp;
+
+uint64_t vkmincomp::hashBytes(const void *data, size_t size, uint64_t seed) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  uint64_t hash = 0xcbf29ce484222325ull ^ seed;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// the header fields are always written least significant byte first
+static uint32_t readLE32(const vector<char> &data, size_t offset) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < 4; ++i)
+    value |= uint32_t(uint8_t(data[offset + i])) << (8 * i);
+  return value;
+}
+
+// VkPipelineCacheHeaderVersionOne, must match the device we are running on
+bool pipelineCache::validHeader(const vector<char> &data) {
+  const size_t headerSize = 16 + VK_UUID_SIZE;
+  if (data.size() < headerSize)
+    return false;
+  if (readLE32(data, 0) < headerSize)
+    return false;
+  if (readLE32(data, 4) != uint32_t(PipelineCacheHeaderVersion::eOne))
+    return false;
+  if (readLE32(data, 8) != this->physdevProps.vendorID ||
+      readLE32(data, 12) != this->physdevProps.deviceID)
+    return false;
+  return memcmp(data.data() + 16, this->physdevProps.pipelineCacheUUID.data(),
+                VK_UUID_SIZE) == 0;
+}
+
+/* Create the pipeline cache, seeded from disk when a matching file exists
+ *
+ * @param physdev The physical device, for vendorID, deviceID and UUID
+ * @param dev The logical device that owns the cache
+ * @param dir The cache directory, nullptr keeps the cache in memory only
+ * @param spirvHash hashBytes() of the SPIR-V code
+ */
+void pipelineCache::open(PhysicalDevice physdev, Device dev, const char *dir,
+                         uint64_t spirvHash) {
+  this->dev = dev;
+  this->physdevProps = physdev.getProperties();
+  vector<char> data;
+  if (dir) {
+    ostringstream name;
+    name << hex << setfill('0') << setw(4) << this->physdevProps.vendorID
+         << '-' << setw(4) << this->physdevProps.deviceID << '-';
+    for (uint8_t b : this->physdevProps.pipelineCacheUUID)
+      name << setw(2) << uint32_t(b);
+    name << '-' << setw(16) << spirvHash << ".vkpc";
+    this->path = (filesystem::path(dir) / name.str()).string();
+
+    ifstream file(this->path, ios::ate | ios::binary);
+    if (file) {
+      data.resize(size_t(file.tellg()));
+      file.seekg(0);
+      file.read(data.data(), data.size());
+      if (!file || !this->validHeader(data)) {
+        cout << "Ignoring invalid pipeline cache " << this->path << endl;
+        data.clear();
+      }
+    }
+  }
+  this->loadedSize = data.size();
+  this->warm = !data.empty();
+  PipelineCacheCreateInfo cacheInfo(PipelineCacheCreateFlags(), data.size(),
+                                    data.data());
+  this->cache = this->dev.createPipelineCache(cacheInfo);
+}
+
+PipelineCache pipelineCache::get() { return this->cache; }
+
+// true when the cache was seeded from a valid file
+bool pipelineCache::isWarm() { return this->warm; }
+
+/* Write the cache back to disk when it grew. The file is written next to the
+ * target and renamed, so a crash never leaves a truncated cache behind. The
+ * temporary name has a random suffix, so two processes saving the same cache
+ * never write into one file.
+ */
+void pipelineCache::save() {
+  if (this->path.empty() || !this->cache)
+    return;
+  vector<uint8_t> data = this->dev.getPipelineCacheData(this->cache);
+  if (data.size() <= this->loadedSize)
+    return;
+  error_code ec;
+  filesystem::create_directories(filesystem::path(this->path).parent_path(),
+                                 ec);
+  string tmpPath =
+      this->path + '.' + to_string(random_device{}()) + ".tmp";
+  ofstream file(tmpPath, ios::binary | ios::trunc);
+  file.write(reinterpret_cast<const char *>(data.data()), data.size());
+  file.close();
+  if (!file || rename(tmpPath.c_str(), this->path.c_str()) != 0) {
+    cout << "Failed to save pipeline cache " << this->path << endl;
+    remove(tmpPath.c_str());
+    return;
+  }
+  this->loadedSize = data.size();
+}
+
+void pipelineCache::destroy() {
+  if (!this->cache)
+    return;
+  this->save();
+  this->dev.destroyPipelineCache(this->cache);
+  this->cache = nullptr;
+}
@@ -0,0 +1,63 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3.0
+// for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <shaderCache.hxx>
+
+using namespace std;
+using namespace vkmincomp;
+
+mutex shaderCache::lock;
+map<tuple<Device, uint64_t, size_t>, shaderCache::entry> shaderCache::modules;
+uint64_t shaderCache::hits = 0, shaderCache::misses = 0;
+
+/* The module of this code on dev, one more user of it
+ *
+ * @param code SPIR-V words, only read when the module is created
+ * @param size The size of the code in bytes
+ * @param hash hashBytes() of the code
+ */
+ShaderModule shaderCache::acquire(Device dev, const uint32_t *code,
+                                  size_t size, uint64_t hash) {
+  lock_guard<mutex> guard(lock);
+  entry &e = modules[make_tuple(dev, hash, size)];
+  if (e.mod) {
+    ++hits;
+  } else {
+    ++misses;
+    e.mod = dev.createShaderModule(
+        ShaderModuleCreateInfo(ShaderModuleCreateFlags(), size, code));
+  }
+  ++e.users;
+  return e.mod;
+}
+
+// one user less, the module is destroyed with the last one
+void shaderCache::release(Device dev, ShaderModule mod) {
+  lock_guard<mutex> guard(lock);
+  for (auto it = modules.begin(); it != modules.end(); ++it)
+    if (std::get<0>(it->first) == dev && it->second.mod == mod) {
+      if (!--it->second.users) {
+        dev.destroyShaderModule(mod);
+        modules.erase(it);
+      }
+      return;
+    }
+}
+
+// modules alive over all devices
+size_t shaderCache::getModuleCount() {
+  lock_guard<mutex> guard(lock);
+  return modules.size();
+}
+
+// acquires served by an existing module
+uint64_t shaderCache::getHits() {
+  lock_guard<mutex> guard(lock);
+  return hits;
+}
+
+// acquires that created a module
+uint64_t shaderCache::getMisses() {
+  lock_guard<mutex> guard(lock);
+  return misses;
+}
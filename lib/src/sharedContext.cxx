@@ -0,0 +1,323 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3.0
+// for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sharedContext.hxx>
+#include <tracer.hxx>
+
+using namespace std;
+using namespace vkmincomp;
+
+mutex sharedContext::globalLock;
+sharedContext *sharedContext::global = nullptr;
+
+/* A context held by the caller alone, release() it when the engines on it
+ * were made. apivers is the highest version of the vulkan driver.
+ *
+ * @param appname The name of your Application Instance
+ * @param appvers Version of your Application
+ * @param engname The name of your Engine
+ * @param engvers Version of your Engine
+ */
+sharedContext::sharedContext(const char *appname, uint32_t appvers,
+                             const char *engname, uint32_t engvers) {
+  uint32_t apivers = enumerateInstanceVersion();
+  this->appInfo = ApplicationInfo(appname, appvers, engname, engvers, apivers);
+  this->instInfo = InstanceCreateInfo({}, &this->appInfo, 0, {}, 0, {});
+}
+
+/* The process wide context, made by the first call and held by the caller.
+ * The names only count for that first call. After the last release the next
+ * call makes a new one.
+ */
+sharedContext *sharedContext::acquire(const char *appname, uint32_t appvers,
+                                      const char *engname, uint32_t engvers) {
+  lock_guard<mutex> guard(globalLock);
+  if (global)
+    global->retain();
+  else
+    global = new sharedContext(appname, appvers, engname, engvers);
+  return global;
+}
+
+void sharedContext::retain() { this->refs.fetch_add(1); }
+
+// drop a reference, the last one destroys the context
+void sharedContext::release() {
+  lock_guard<mutex> guard(globalLock);
+  if (this->refs.fetch_sub(1) != 1)
+    return;
+  if (global == this)
+    global = nullptr;
+  delete this;
+}
+
+// the engines and callers holding the context
+uint32_t sharedContext::getRefCount() { return this->refs.load(); }
+
+void sharedContext::makeInstance() {
+  if (!this->inst)
+    this->inst = createInstance(this->instInfo);
+}
+
+// the instance, made on the first call
+Instance sharedContext::getInstance() {
+  lock_guard<mutex> guard(this->lock);
+  this->makeInstance();
+  return this->inst;
+}
+
+/* Higher is better: the device type first, then the largest device local
+ * heap, the number of compute queues and the workgroup size limit. 0 when
+ * the device has no compute queue.
+ */
+uint64_t sharedContext::scoreDevice(PhysicalDevice physdev) {
+  uint32_t computeQueues = 0;
+  for (QueueFamilyProperties &qFamProp : physdev.getQueueFamilyProperties())
+    if (qFamProp.queueFlags & QueueFlagBits::eCompute)
+      computeQueues += qFamProp.queueCount;
+  if (!computeQueues)
+    return 0;
+  PhysicalDeviceProperties props = physdev.getProperties();
+  uint64_t typeRank = 1;
+  switch (props.deviceType) {
+  case PhysicalDeviceType::eDiscreteGpu:
+    typeRank = 5;
+    break;
+  case PhysicalDeviceType::eIntegratedGpu:
+    typeRank = 4;
+    break;
+  case PhysicalDeviceType::eVirtualGpu:
+    typeRank = 3;
+    break;
+  case PhysicalDeviceType::eCpu:
+    typeRank = 2;
+    break;
+  default:
+    break;
+  }
+  DeviceSize heap = 0;
+  PhysicalDeviceMemoryProperties memProps = physdev.getMemoryProperties();
+  for (uint32_t i = 0; i < memProps.memoryHeapCount; ++i)
+    if (memProps.memoryHeaps[i].flags & MemoryHeapFlagBits::eDeviceLocal)
+      heap = max(heap, memProps.memoryHeaps[i].size);
+  uint64_t score = typeRank << 56;
+  score |= min<uint64_t>(heap >> 20, (uint64_t(1) << 36) - 1) << 20;
+  score |= uint64_t(min(computeQueues, 255u)) << 12;
+  score |= min(props.limits.maxComputeWorkGroupInvocations, 4095u);
+  return score;
+}
+
+// rankDevices without the lock, the instance must be made
+vector<uint32_t> sharedContext::rank() {
+  vector<PhysicalDevice> physdevs = this->inst.enumeratePhysicalDevices();
+  vector<pair<uint64_t, uint32_t>> scored;
+  for (uint32_t i = 0; i < physdevs.size(); ++i) {
+    uint64_t score = scoreDevice(physdevs.at(i));
+    if (score)
+      scored.push_back({score, i});
+  }
+  stable_sort(scored.begin(), scored.end(),
+              [](const pair<uint64_t, uint32_t> &a,
+                 const pair<uint64_t, uint32_t> &b) {
+                return a.first > b.first;
+              });
+  vector<uint32_t> ranked;
+  for (auto &s : scored)
+    ranked.push_back(s.second);
+  return ranked;
+}
+
+/* Every physical device that has a compute queue, the best scored first
+ *
+ * @return indices for open() and stdEng::setPhysicalDevice
+ */
+vector<uint32_t> sharedContext::rankDevices() {
+  lock_guard<mutex> guard(this->lock);
+  this->makeInstance();
+  return this->rank();
+}
+
+/* Whether physdev has buffer device addresses: the feature, core from Vulkan
+ * 1.2 and VK_KHR_buffer_device_address before, and the allocate flags of 1.1
+ */
+bool sharedContext::addressSupported(PhysicalDevice physdev) {
+  uint32_t apiVersion =
+      min(this->appInfo.apiVersion, physdev.getProperties().apiVersion);
+  if (apiVersion < VK_API_VERSION_1_1)
+    return false;
+  bool hasExt = apiVersion >= VK_API_VERSION_1_2;
+  for (ExtensionProperties ext : physdev.enumerateDeviceExtensionProperties())
+    if (!strcmp(ext.extensionName.data(),
+                VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME))
+      hasExt = true;
+  return hasExt &&
+         physdev
+             .getFeatures2<PhysicalDeviceFeatures2,
+                           PhysicalDeviceBufferDeviceAddressFeatures>()
+             .get<PhysicalDeviceBufferDeviceAddressFeatures>()
+             .bufferDeviceAddress;
+}
+
+/* Whether an engine on the context gets buffer device addresses: from the
+ * device when it is open, from the one open() would take otherwise
+ *
+ * @param physdevIndex ~0 for the best scored device
+ */
+bool sharedContext::addressSupported(uint32_t physdevIndex) {
+  lock_guard<mutex> guard(this->lock);
+  if (this->dev)
+    return this->address;
+  this->makeInstance();
+  vector<PhysicalDevice> physdevs = this->inst.enumeratePhysicalDevices();
+  if (physdevIndex == uint32_t(~0)) {
+    vector<uint32_t> ranked = this->rank();
+    if (ranked.empty())
+      return false;
+    physdevIndex = ranked.front();
+  }
+  return physdevIndex < physdevs.size() &&
+         this->addressSupported(physdevs.at(physdevIndex));
+}
+
+/* Create the device, once. The calls after the first return right away and
+ * their arguments are ignored.
+ *
+ * @param physdevIndex Index into vkEnumeratePhysicalDevices, ~0 for the best
+ * scored device
+ * @param queueCount Compute queues wanted, the family may have fewer
+ * @param priority The priority of every queue
+ * @return false when there is no usable device, the reason is printed
+ */
+bool sharedContext::open(uint32_t physdevIndex, uint32_t queueCount,
+                         float priority) {
+  lock_guard<mutex> guard(this->lock);
+  if (this->dev)
+    return true;
+  this->makeInstance();
+  vector<PhysicalDevice> physdevs = this->inst.enumeratePhysicalDevices();
+  if (physdevs.empty()) {
+    cout << "No Vulkan driver found!" << endl;
+    return false;
+  }
+  uint32_t index = physdevIndex;
+  if (index == uint32_t(~0)) {
+    vector<uint32_t> ranked = this->rank();
+    index = ranked.empty() ? 0 : ranked.front();
+  } else if (index >= physdevs.size()) {
+    cout << "No physical device " << index << "!" << endl;
+    return false;
+  }
+  this->physdev = physdevs.at(index);
+  vector<QueueFamilyProperties> qFamProps =
+      this->physdev.getQueueFamilyProperties();
+  // a compute family without graphics is an async compute engine that does
+  // not share its queues with rendering, it goes before a general family
+  auto qFamProp = find_if(
+      qFamProps.begin(), qFamProps.end(), [](QueueFamilyProperties qFamPropsT) {
+        return (qFamPropsT.queueFlags & QueueFlagBits::eCompute) &&
+               !(qFamPropsT.queueFlags & QueueFlagBits::eGraphics);
+      });
+  if (qFamProp == qFamProps.end())
+    qFamProp = find_if(qFamProps.begin(), qFamProps.end(),
+                       [](QueueFamilyProperties qFamPropsT) {
+                         return qFamPropsT.queueFlags & QueueFlagBits::eCompute;
+                       });
+  this->queueFamIndex = distance(qFamProps.begin(), qFamProp);
+  if (this->queueFamIndex == qFamProps.size()) {
+    cout << "No Queue Family found!" << endl;
+    return false;
+  }
+  this->queueCount = max(min(queueCount, qFamProp->queueCount), 1u);
+
+  // a family with transfer but without compute and graphics is usually a
+  // dedicated copy engine that runs next to the compute queue
+  this->transferFamIndex = this->queueFamIndex;
+  this->transferQueueCount = 1;
+  for (uint32_t i = 0; i < qFamProps.size(); ++i) {
+    QueueFlags flags = qFamProps[i].queueFlags;
+    if ((flags & QueueFlagBits::eTransfer) &&
+        !(flags & (QueueFlagBits::eCompute | QueueFlagBits::eGraphics))) {
+      this->transferFamIndex = i;
+      this->transferQueueCount =
+          max(min(this->queueCount, qFamProps[i].queueCount), 1u);
+      break;
+    }
+  }
+  this->queuePriorities.assign(
+      max(this->queueCount, this->transferQueueCount), priority);
+  this->devQInfo = DeviceQueueCreateInfo(
+      DeviceQueueCreateFlags(), this->queueFamIndex, this->queueCount,
+      this->queuePriorities.data());
+  this->devQInfos = {this->devQInfo};
+  if (this->transferFamIndex != this->queueFamIndex)
+    this->devQInfos.push_back(DeviceQueueCreateInfo(
+        DeviceQueueCreateFlags(), this->transferFamIndex,
+        this->transferQueueCount, this->queuePriorities.data()));
+
+  /* importing caller owned host memory for inputs, when the driver can. Its
+   * properties are read with vkGetPhysicalDeviceProperties2 of Vulkan 1.1,
+   * where VK_KHR_external_memory is core as well.
+   */
+  uint32_t apiVersion =
+      min(this->appInfo.apiVersion, this->physdev.getProperties().apiVersion);
+  bool hostExt = false, externalExt = false;
+  for (ExtensionProperties ext :
+       this->physdev.enumerateDeviceExtensionProperties()) {
+    if (!strcmp(ext.extensionName.data(),
+                VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME))
+      hostExt = true;
+    if (!strcmp(ext.extensionName.data(),
+                VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME))
+      externalExt = true;
+  }
+  this->hostImport = hostExt && apiVersion >= VK_API_VERSION_1_1;
+  if (this->hostImport) {
+    if (externalExt && this->physdev.getProperties().apiVersion <
+                           VK_API_VERSION_1_1)
+      this->devExts.push_back(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
+    this->devExts.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    auto props = this->physdev.getProperties2<
+        PhysicalDeviceProperties2,
+        PhysicalDeviceExternalMemoryHostPropertiesEXT>();
+    this->hostImportAlign =
+        props.get<PhysicalDeviceExternalMemoryHostPropertiesEXT>()
+            .minImportedHostPointerAlignment;
+  }
+  // buffer device addresses, core from Vulkan 1.2 and an extension before
+  this->address = this->addressSupported(this->physdev);
+  this->addressCore = apiVersion >= VK_API_VERSION_1_2;
+  if (this->address && !this->addressCore)
+    this->devExts.push_back(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME);
+  this->devInfo = DeviceCreateInfo({}, this->devQInfos, {}, this->devExts);
+  if (this->address) {
+    this->addrFeatures = PhysicalDeviceBufferDeviceAddressFeatures(true);
+    this->devInfo.pNext = &this->addrFeatures;
+  }
+  this->dev = this->physdev.createDevice(this->devInfo);
+  this->dld.init(this->inst, vkGetInstanceProcAddr, this->dev,
+                 vkGetDeviceProcAddr);
+  return true;
+}
+
+// true once the device is made
+bool sharedContext::isOpen() {
+  lock_guard<mutex> guard(this->lock);
+  return bool(this->dev);
+}
+
+// the engines are gone, their work was waited for
+sharedContext::~sharedContext() {
+  traceScope scope("~sharedContext");
+  this->submits.flush();
+
+  tracer::instant("destroy device");
+  if (this->dev)
+    this->dev.destroy();
+
+  tracer::instant("destroy instance");
+  if (this->inst)
+    this->inst.destroy();
+}
@@ -0,0 +1,256 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3.0
+// for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vkmincomp.hxx>
+
+using namespace std;
+using namespace vkmincomp;
+
+/* The arguments of the stdEng constructor, and what to do on every engine
+ * before it is built: shader, bindings, inputs and outputs like for a single
+ * engine. setInputs and setOutputs give the sizes of the whole problem, the
+ * data of input 0 is taken from run() instead.
+ */
+splitEng::splitEng(const char *appname, uint32_t appvers, const char *engname,
+                   uint32_t engvers, function<void(stdEng &)> setup)
+    : appname(appname), engname(engname), appvers(appvers), engvers(engvers),
+      setup(setup) {}
+
+/* The physical devices to use, by index. By default every device with a
+ * compute queue, the best scored first.
+ *
+ * @param devices Indices into vkEnumeratePhysicalDevices, may repeat
+ */
+void splitEng::setDevices(vector<uint32_t> devices) {
+  this->devices = devices;
+}
+
+// @param elemCount The number of elements in input 0 and output 0
+void splitEng::setElementCount(uint32_t elemCount) {
+  this->elemCount = elemCount;
+}
+
+/* Push the range of each device as two uint32, the first element and the
+ * count, for kernels that need the global index. The engines must have a
+ * push constant range covering it, see stdEng::setPushConstantSize.
+ *
+ * @param offset Where the pair goes in the push constant block
+ */
+void splitEng::setRangePushConstant(uint32_t offset) {
+  this->rangePush = offset;
+}
+
+// (re)create the engine of p with buffers for p.capacity elements
+void splitEng::createEngine(part &p) {
+  if (p.eng && p.eng->isBuilt()) {
+    delete p.eng;
+    p.eng = nullptr;
+  }
+  if (!p.eng)
+    p.eng = new stdEng(this->appname, this->appvers, this->engname,
+                       this->engvers);
+  p.eng->setPhysicalDevice(p.device);
+  this->setup(*p.eng);
+  vector<size_t> insizes = p.eng->getInputSizes();
+  vector<size_t> outsizes = p.eng->getOutputSizes();
+  if (insizes.empty() || outsizes.empty()) {
+    cout << "Split needs input 0 and output 0!" << endl;
+    delete this;
+    exit(EXIT_FAILURE);
+  }
+  if (!this->inElemSize) {
+    this->inElemSize = insizes.at(0) / this->elemCount;
+    this->outElemSize = outsizes.at(0) / this->elemCount;
+    if (!this->inElemSize || !this->outElemSize) {
+      cout << "Input 0 and output 0 are smaller than the elements!" << endl;
+      delete this;
+      exit(EXIT_FAILURE);
+    }
+  }
+  // input 0 is written by run(), not copied from setInputs
+  p.eng->setStreamSizes(max(p.capacity, 1u) * this->inElemSize,
+                        max(p.capacity, 1u) * this->outElemSize);
+  p.eng->build();
+}
+
+/* Cut the elements by weight, the rounding leftover goes to the device with
+ * the largest weight
+ */
+void splitEng::assignRanges() {
+  double sum = 0;
+  for (part &p : this->parts)
+    sum += p.weight;
+  uint32_t given = 0;
+  size_t heaviest = 0;
+  for (size_t i = 0; i < this->parts.size(); ++i) {
+    part &p = this->parts.at(i);
+    p.count = uint32_t(this->elemCount * (p.weight / sum));
+    given += p.count;
+    if (p.weight > this->parts.at(heaviest).weight)
+      heaviest = i;
+  }
+  this->parts.at(heaviest).count += this->elemCount - given;
+  uint32_t first = 0;
+  for (part &p : this->parts) {
+    p.first = first;
+    first += p.count;
+  }
+}
+
+/* Create one engine per device, the first ranges are even. The engine used to
+ * list the devices becomes the one of the best device.
+ */
+void splitEng::build() {
+  if (!this->elemCount) {
+    cout << "Split needs setElementCount!" << endl;
+    delete this;
+    exit(EXIT_FAILURE);
+  }
+  stdEng *first = nullptr;
+  if (this->devices.empty()) {
+    first = new stdEng(this->appname, this->appvers, this->engname,
+                       this->engvers);
+    this->devices = first->rankDevices();
+    if (this->devices.empty()) {
+      cout << "No device can compute!" << endl;
+      delete first;
+      delete this;
+      exit(EXIT_FAILURE);
+    }
+  }
+  this->parts.resize(this->devices.size());
+  for (size_t i = 0; i < this->parts.size(); ++i) {
+    this->parts.at(i).device = this->devices.at(i);
+    this->parts.at(i).weight = 1.0 / this->parts.size();
+  }
+  this->parts.front().eng = first;
+  this->assignRanges();
+  for (part &p : this->parts) {
+    p.capacity = min(this->elemCount, p.count + p.count / 4);
+    this->createEngine(p);
+  }
+  this->built = true;
+}
+
+/* Run the kernel over all elements, every device on its range at the same
+ * time. A device that got more elements than its buffers hold is rebuilt
+ * first. The time of each device, from its upload to its readback, sets the
+ * weights of the next run.
+ *
+ * @param src elemCount elements of input 0
+ * @param dst Room for elemCount elements of output 0
+ */
+splitStats splitEng::run(const void *src, void *dst) {
+  if (!this->built)
+    this->build();
+  this->assignRanges();
+  for (part &p : this->parts)
+    if (p.count > p.capacity) {
+      p.capacity = min(this->elemCount, p.count + p.count / 4);
+      this->createEngine(p);
+    }
+
+  vector<submission> subs(this->parts.size());
+  vector<chrono::steady_clock::time_point> starts(this->parts.size());
+  auto start = chrono::steady_clock::now();
+  size_t pending = 0;
+  for (size_t i = 0; i < this->parts.size(); ++i) {
+    part &p = this->parts.at(i);
+    if (!p.count)
+      continue;
+    starts.at(i) = chrono::steady_clock::now();
+    memcpy(p.eng->inputSpan<char>(0).data(),
+           static_cast<const char *>(src) + p.first * this->inElemSize,
+           p.count * this->inElemSize);
+    p.eng->setElementCount(p.count);
+    if (this->rangePush != uint32_t(~0)) {
+      uint32_t range[2] = {p.first, p.count};
+      p.eng->setPushConstants(range, this->rangePush);
+    }
+    subs.at(i) = p.eng->submit();
+    ++pending;
+  }
+  // a device is timed when its submission is seen done
+  vector<bool> done(this->parts.size(), false);
+  while (pending) {
+    for (size_t i = 0; i < subs.size(); ++i)
+      if (subs.at(i).valid() && !done.at(i) && subs.at(i).ready()) {
+        this->parts.at(i).nanoseconds =
+            chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - starts.at(i))
+                .count();
+        done.at(i) = true;
+        --pending;
+      }
+    if (pending)
+      this_thread::yield();
+  }
+  for (size_t i = 0; i < this->parts.size(); ++i) {
+    part &p = this->parts.at(i);
+    if (p.count)
+      p.eng->readOutput(subs.at(i), 0,
+                        static_cast<char *>(dst) + p.first * this->outElemSize,
+                        p.count * this->outElemSize);
+  }
+
+  splitStats stats;
+  stats.nanoseconds = chrono::duration_cast<chrono::nanoseconds>(
+                          chrono::steady_clock::now() - start)
+                          .count();
+  stats.elemsPerSec =
+      this->elemCount * 1e9 / max(stats.nanoseconds, uint64_t(1));
+
+  /* elements per nanosecond of every device that ran, half of the new weight
+   * comes from this run so one noisy run does not move the ranges too far
+   */
+  double sum = 0, measuredSum = 0;
+  vector<double> rates(this->parts.size(), 0);
+  for (size_t i = 0; i < this->parts.size(); ++i) {
+    part &p = this->parts.at(i);
+    if (!p.count)
+      continue;
+    ++stats.devices;
+    rates.at(i) = double(p.count) / max(p.nanoseconds, uint64_t(1));
+    sum += rates.at(i);
+    measuredSum += p.weight;
+  }
+  for (size_t i = 0; i < this->parts.size(); ++i) {
+    part &p = this->parts.at(i);
+    if (p.count)
+      p.weight = 0.5 * p.weight + 0.5 * measuredSum * rates.at(i) / sum;
+  }
+  return stats;
+}
+
+vector<uint32_t> splitEng::getDevices() { return this->devices; }
+
+// the share of the elements each device gets on the next run
+vector<double> splitEng::getWeights() {
+  double sum = 0;
+  for (part &p : this->parts)
+    sum += p.weight;
+  vector<double> weights;
+  for (part &p : this->parts)
+    weights.push_back(p.weight / sum);
+  return weights;
+}
+
+// the number of elements each device got on the last run
+vector<uint32_t> splitEng::getRanges() {
+  vector<uint32_t> ranges;
+  for (part &p : this->parts)
+    ranges.push_back(p.count);
+  return ranges;
+}
+
+// every engine, built or not
+splitEng::~splitEng() {
+  for (part &p : this->parts)
+    if (p.eng)
+      delete p.eng;
+}
@@ -0,0 +1,110 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3.0
+// for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <iostream>
+#include <stagingRing.hxx>
+
+using namespace std;
+using namespace vkmincomp;
+
+static DeviceSize alignUp(DeviceSize value, DeviceSize alignment) {
+  return alignment > 1 ? (value + alignment - 1) / alignment * alignment
+                       : value;
+}
+
+/* The ring has its own allocation, it stays mapped until destroy()
+ *
+ * @param size The size of the ring in byte
+ * @param queueFamIndices Every queue family that copies from or to the ring,
+ * more than one makes the buffer concurrent
+ */
+void stagingRing::create(PhysicalDevice physdev, Device dev, DeviceSize size,
+                         const vector<uint32_t> &queueFamIndices) {
+  this->dev = dev;
+  this->size = size;
+  BufferCreateInfo buffInfo(BufferCreateFlags(), size,
+                            BufferUsageFlagBits::eTransferSrc |
+                                BufferUsageFlagBits::eTransferDst,
+                            SharingMode::eExclusive);
+  if (queueFamIndices.size() > 1) {
+    buffInfo.sharingMode = SharingMode::eConcurrent;
+    buffInfo.queueFamilyIndexCount = uint32_t(queueFamIndices.size());
+    buffInfo.pQueueFamilyIndices = queueFamIndices.data();
+  }
+  this->buff = dev.createBuffer(buffInfo);
+  MemoryRequirements memReq = dev.getBufferMemoryRequirements(this->buff);
+
+  // cached memory makes the host reads of downloads fast
+  PhysicalDeviceMemoryProperties memProps = physdev.getMemoryProperties();
+  MemoryPropertyFlags required = MemoryPropertyFlagBits::eHostVisible |
+                                 MemoryPropertyFlagBits::eHostCoherent;
+  uint32_t typeIndex = uint32_t(~0);
+  for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i) {
+    MemoryPropertyFlags flags = memProps.memoryTypes[i].propertyFlags;
+    if (!(memReq.memoryTypeBits & (1u << i)) || (flags & required) != required)
+      continue;
+    if (typeIndex == uint32_t(~0) ||
+        (flags & MemoryPropertyFlagBits::eHostCached))
+      typeIndex = i;
+    if (flags & MemoryPropertyFlagBits::eHostCached)
+      break;
+  }
+  if (typeIndex == uint32_t(~0)) {
+    cout << "No host visible memory for the staging ring" << endl;
+    exit(EXIT_FAILURE);
+  }
+  this->mem = dev.allocateMemory(MemoryAllocateInfo(memReq.size, typeIndex));
+  dev.bindBufferMemory(this->buff, this->mem, 0);
+  this->ptr = static_cast<char *>(dev.mapMemory(this->mem, 0, size));
+}
+
+/* @return the offset of the reserved range or ~0 when the ring is full
+ */
+DeviceSize stagingRing::reserve(DeviceSize size, DeviceSize alignment) {
+  if (this->empty)
+    this->head = this->tail = 0;
+  DeviceSize offset = alignUp(this->head, alignment);
+  if (this->empty || this->head > this->tail) {
+    if (offset + size > this->size) {
+      // wrap around, the head must not catch up with the tail
+      offset = 0;
+      if (!this->empty && size >= this->tail)
+        return DeviceSize(~0);
+      if (this->empty && size > this->size)
+        return DeviceSize(~0);
+    }
+  } else if (offset + size >= this->tail) {
+    return DeviceSize(~0);
+  }
+  this->head = offset + size;
+  this->empty = false;
+  return offset;
+}
+
+// position of the head, give it to release() when the work is done
+DeviceSize stagingRing::mark() { return this->head; }
+
+// everything reserved before the mark may be overwritten again
+void stagingRing::release(DeviceSize mark) {
+  if (this->empty)
+    return;
+  this->tail = mark;
+  if (this->tail == this->head)
+    this->empty = true;
+}
+
+DeviceSize stagingRing::capacity() { return this->size; }
+
+Buffer stagingRing::buffer() { return this->buff; }
+
+void *stagingRing::data(DeviceSize offset) { return this->ptr + offset; }
+
+void stagingRing::destroy() {
+  if (!this->buff)
+    return;
+  this->dev.unmapMemory(this->mem);
+  this->dev.destroyBuffer(this->buff);
+  this->dev.freeMemory(this->mem);
+  this->buff = nullptr;
+  this->ptr = nullptr;
+}
@@ -1,15 +1,25 @@
 // Copyright 2024 M Reza Dwi Prasetiawan
 // License under GNU GPL v3.0
 // for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <thread>
 #include <vkmincomp.hxx>
 
 using namespace std;
 using namespace vkmincomp;
 
+// tells the lanes of engines apart, an address may be reused
+static atomic<uint64_t> nextEngineId{1};
+
 // metode public
-/* the one and only one constructor to create an instance
+/* An engine with an instance and a device of its own, they are made by
+ * build() or by the first call that needs the instance
  *
  * @param appname The name of your Application Instance
  * @param appvers Version of your Application
@@ -19,14 +29,21 @@ using namespace vkmincomp;
  * apivers use available and the higher version API of the vulkan driver
  */
 stdEng::stdEng(const char *appname, uint32_t appvers, const char *engname,
-               uint32_t engvers) {
-  uint32_t apivers = enumerateInstanceVersion();
-  ApplicationInfo appInfo(appname, appvers, engname, engvers, apivers);
-  this->appInfo = appInfo;
-  InstanceCreateInfo instInfo({}, &appInfo, 0, {}, 0, {});
-  this->instInfo = instInfo;
-  Instance inst = createInstance(instInfo);
-  this->inst = inst;
+               uint32_t engvers)
+    : ctx(new sharedContext(appname, appvers, engname, engvers)) {
+  this->engineId = nextEngineId++;
+}
+
+/* An engine on the instance and device of ctx, its buffers, descriptors and
+ * pipelines are its own. The first engine to build opens the device, with
+ * its setPhysicalDevice, setQueueCount and setPriority, the next ones use
+ * it as it is, so building them costs their pipeline and buffers only.
+ *
+ * @param ctx Held until the engine is destroyed, see sharedContext::acquire
+ */
+stdEng::stdEng(sharedContext *ctx) : ctx(ctx) {
+  this->ctx->retain();
+  this->engineId = nextEngineId++;
 }
 
 /* Actually Priorities are array but we only use 1 device
@@ -34,6 +51,28 @@ stdEng::stdEng(const char *appname, uint32_t appvers, const char *engname,
  */
 void stdEng::setPriority(float priority) { this->priority = priority; }
 
+/* Every physical device that has a compute queue, the best scored first
+ *
+ * @return indices for setPhysicalDevice
+ */
+vector<uint32_t> stdEng::rankDevices() { return this->ctx->rankDevices(); }
+
+/* Use this device instead of the best scored one, before build()
+ *
+ * @param index Index into vkEnumeratePhysicalDevices, see rankDevices
+ */
+void stdEng::setPhysicalDevice(uint32_t index) { this->physdevIndex = index; }
+
+// the name of the device the engine was built on
+string stdEng::getDeviceName() {
+  if (!this->built)
+    return string();
+  return string(this->physdev.getProperties().deviceName.data());
+}
+
+// true once build() is done
+bool stdEng::isBuilt() { return this->built; }
+
 /* For inputs stuff
  *
  * @param inputs vector from vector of the input arrays
@@ -42,6 +81,7 @@ void stdEng::setPriority(float priority) { this->priority = priority; }
 void stdEng::setInputs(vector<vector<void *>> inputs, vector<size_t> size) {
   this->inputs = inputs;
   this->insizes = size;
+  ++this->inputsGen;
 }
 
 // Same as inputs
@@ -50,6 +90,28 @@ void stdEng::setOutputs(vector<vector<void *>> outputs, vector<size_t> size) {
   this->outsizes = size;
 }
 
+/* Before build(), after setInputs and setOutputs: input 0 and output 0 hold
+ * one chunk only, and input 0 is written through inputSpan before every
+ * submission instead of copied from setInputs, like in stream(). The other
+ * inputs keep the data of setInputs.
+ *
+ * @param inSize, outSize The size of input 0 and output 0 in byte
+ */
+void stdEng::setStreamSizes(size_t inSize, size_t outSize) {
+  if (this->built || this->insizes.empty() || this->outsizes.empty()) {
+    cout << "Stream sizes need input 0 and output 0 before build()!" << endl;
+    delete this;
+    exit(EXIT_FAILURE);
+  }
+  this->insizes.at(0) = inSize;
+  this->outsizes.at(0) = outSize;
+  this->streaming = true;
+}
+
+// the size of each input and output in byte, as the buffers are made
+vector<size_t> stdEng::getInputSizes() { return this->insizes; }
+vector<size_t> stdEng::getOutputSizes() { return this->outsizes; }
+
 /* Set up binding in the shader
  *
  * Using this library means you must group the set&binding of inputs together
@@ -66,10 +128,22 @@ void stdEng::setOutputs(vector<vector<void *>> outputs, vector<size_t> size) {
 void stdEng::setBindings(vector<uint32_t> bindings, uint32_t IOSetOffset,
                          uint32_t IOBindingOffset) {
   this->bindings = bindings;
+  this->IOOffsets = true;
   this->IOSetOffset = IOSetOffset;
   this->IOBindingOffset = IOBindingOffset;
 }
 
+/* Same, with the outputs right after the inputs: the buffers are bound in one
+ * flat order, set 0 takes the first bindings[0] of them at bindings 0, 1 and
+ * so on, set 1 the next bindings[1], and so on.
+ */
+void stdEng::setBindings(vector<uint32_t> bindings) {
+  this->bindings = bindings;
+  this->IOOffsets = false;
+  this->IOSetOffset = 0;
+  this->IOBindingOffset = 0;
+}
+
 /* The shader used, as far as I know, is SPIR-V, which is usually compiled from
  * HLSL or GLSL.
  *
@@ -78,9 +152,22 @@ void stdEng::setBindings(vector<uint32_t> bindings, uint32_t IOSetOffset,
  */
 void stdEng::setShaderFile(const char *filepath) { this->filepath = filepath; }
 
+/* SPIR-V already in memory, like an array embedded by
+ * cmake/embedSpirv.cmake, instead of setShaderFile. Nothing is read from
+ * disk and engines on one device share the module.
+ *
+ * @param code The words of the module, must stay valid until build()
+ * @param size The size of the code in bytes
+ */
+void stdEng::setShaderCode(const uint32_t *code, size_t size) {
+  this->shadCode = code;
+  this->shadCodeSize = size;
+}
+
 /* Set the name of the m ain function or entry point in the shader
  * In shaders, you can have multiple functions, so you need to know where the
- * main function is.
+ * main function is. May change after build(), the next submit uses the
+ * pipeline of the new entry point, see createPipelines.
  *
  * @param entryPoint The name of the function as the entry point in the shader.
  */
@@ -88,11 +175,13 @@ void stdEng::setEntryPoint(const char *entryPoint) {
   this->entryPoint = entryPoint;
 }
 
-/* setWorkgroupSize is the size of the workgroup in the shader
+/* setWorkgroupSize is the number of workgroups dispatched, the size of one
+ * workgroup is the local size of the shader, see setLocalSize. Not used once
+ * setElementCount was called.
  *
- * @param width The width of the workgroup
- * @param height The height of the workgroup
- * @param depth The depth of the workgroup
+ * @param width The number of workgroups in x
+ * @param height The number of workgroups in y
+ * @param depth The number of workgroups in z
  */
 void stdEng::setWorkgroupSize(uint32_t width, uint32_t height, uint32_t depth) {
   this->width = width;
@@ -100,12 +189,423 @@ void stdEng::setWorkgroupSize(uint32_t width, uint32_t height, uint32_t depth) {
   this->depth = depth;
 }
 
+/* Local size of the shader through specialization constants 0, 1 and 2, the
+ * shader declares them with layout(local_size_x_id = 0, local_size_y_id = 1,
+ * local_size_z_id = 2) in. May change after build(), every local size gets
+ * its own pipeline, created once and kept.
+ *
+ * @param x, y, z The size of one workgroup
+ */
+void stdEng::setLocalSize(uint32_t x, uint32_t y, uint32_t z) {
+  this->localSize[0] = x;
+  this->localSize[1] = y;
+  this->localSize[2] = z;
+}
+
+/* Raw form of setSpecConstant
+ *
+ * @param id The constant_id in the shader, 0 to 2 are the local size when
+ * setLocalSize is used
+ * @param bits The 32 bit value
+ */
+void stdEng::setSpecConstantBits(uint32_t id, uint32_t bits) {
+  this->specConsts[id] = bits;
+}
+
+/* Dispatch enough workgroups to cover the elements, the number of workgroups
+ * is the element count divided by the local size, rounded up. The shader
+ * must skip the invocations past the end.
+ *
+ * @param x, y, z The number of elements in each dimension
+ */
+void stdEng::setElementCount(uint32_t x, uint32_t y, uint32_t z) {
+  this->elemCount[0] = x;
+  this->elemCount[1] = y;
+  this->elemCount[2] = z;
+}
+
 /* Iam using Fence for mark  if our calculation finish
  *
  * @param time timeout for waiting the fence
  */
 void stdEng::setWaitFenceFor(uint64_t time) { this->time = time; }
 
+/* Keep compiled pipelines on disk between runs
+ *
+ * @param cacheDir Directory of the pipeline cache files, created when missing.
+ * Without it the cache only lives as long as the engine.
+ */
+void stdEng::setPipelineCacheDir(const char *cacheDir) {
+  this->cacheDir = cacheDir;
+}
+
+/* Input and output buffers are sub allocated from blocks of this size, one
+ * vkAllocateMemory per block instead of one per buffer.
+ *
+ * @param blockSize The size of a memory block in byte, 64 MiB by default
+ */
+void stdEng::setMemoryBlockSize(DeviceSize blockSize) {
+  this->arena.setBlockSize(blockSize);
+}
+
+/* @param placement Where the input and output buffers are allocated
+ * @see MemoryPlacement
+ */
+void stdEng::setMemoryPlacement(MemoryPlacement placement) {
+  this->placement = placement;
+}
+
+/* With DEVICE_LOCAL buffers inputs and outputs go through a staging ring
+ *
+ * @param stagingSize Minimum size of the ring in byte, it always holds at
+ * least two dispatches worth of inputs and outputs
+ */
+void stdEng::setStagingSize(DeviceSize stagingSize) {
+  this->stagingSize = stagingSize;
+}
+
+/* Submissions that may run on the gpu at once, each has its own buffers,
+ * command buffers, descriptor sets and fence. With more than one the host
+ * fills the inputs of the next submission while the gpu runs the previous.
+ *
+ * @param framesInFlight At least 1, the default. Set it before build().
+ */
+void stdEng::setFramesInFlight(uint32_t framesInFlight) {
+  if (this->built) {
+    cout << "Frames in flight must be set before build!" << endl;
+    return;
+  }
+  this->framesInFlight = max(framesInFlight, 1u);
+}
+
+/* Compute queues to spread the frames over. Independent submissions go to
+ * the least busy one and may run at the same time on the gpu.
+ *
+ * @param queueCount 0, the default, asks for one per frame in flight. The
+ * device may offer less. Set it before build().
+ */
+void stdEng::setQueueCount(uint32_t queueCount) {
+  if (this->built) {
+    cout << "Queue count must be set before build!" << endl;
+    return;
+  }
+  this->queueCount = queueCount;
+}
+
+/* Record the command buffers of each frame once and submit them again as
+ * they are, for jobs of a fixed shape. They are recorded again only when the
+ * pipeline, the workgroup count or the push constants changed, or the
+ * buffers behind the descriptor sets moved. Each frame then keeps the same
+ * staging ranges for all its submissions.
+ *
+ * @param reuse false, the default, records every submission. Set it before
+ * build().
+ */
+void stdEng::setCommandReuse(bool reuse) {
+  if (this->built) {
+    cout << "Command reuse must be set before build!" << endl;
+    return;
+  }
+  this->reuseCommands = reuse;
+}
+
+/* Reach the buffers through their 64 bit device address instead of
+ * descriptor sets. No set layout, pool or set is made and nothing is bound
+ * per dispatch, the addresses of the inputs and then the outputs lead the
+ * push constant block, 8 bytes each, followed by the data of
+ * setPushConstants at its offset. The shader declares them as buffer
+ * references (GL_EXT_buffer_reference).
+ *
+ * Devices without it, see supportsAddressMode, keep using the descriptors of
+ * setBindings, they need a shader with bindings.
+ *
+ * @param enable false, the default, binds descriptor sets. Set it before
+ * build().
+ */
+void stdEng::setAddressMode(bool enable) {
+  if (this->built) {
+    cout << "Address mode must be set before build!" << endl;
+    return;
+  }
+  this->addressMode = enable;
+}
+
+// whether build() got device addresses for the buffers
+bool stdEng::isAddressMode() { return this->addressMode; }
+
+/* Whether setAddressMode(true) will hold on the device build() takes, the
+ * shader can be chosen by it before build()
+ */
+bool stdEng::supportsAddressMode() {
+  return this->ctx->addressSupported(this->physdevIndex);
+}
+
+// recordings, reuses and recording time of submit() so far
+recordStats stdEng::getRecordStats() { return this->recStats; }
+
+/* Time every submission: the host side of submit() and of waiting, and with
+ * gpu timestamps the upload, the barriers, the dispatch and the download.
+ * It costs a few clock reads and six timestamps per submission, the results
+ * are read back without waiting once the frame is seen done. The steps of
+ * build() are always timed.
+ *
+ * Copies on a dedicated transfer queue run next to the compute queue and are
+ * not timed, that queue can not reset a query pool.
+ *
+ * @param enable false, the default. Set it before build().
+ */
+void stdEng::setProfiling(bool enable) {
+  if (this->built) {
+    cout << "Profiling must be set before build!" << endl;
+    return;
+  }
+  this->profiling = enable;
+}
+
+// the timings collected so far
+profileStats stdEng::getProfileStats() { return this->profile; }
+
+// the compute queues the engine got from the device, after build()
+uint32_t stdEng::getQueueCount() { return uint32_t(this->queues.size()); }
+
+/* Declare the push constant range of the kernel, bytes 0 to size visible to
+ * the compute stage. setPushConstants declares it too, this is for a block
+ * larger than the first value set.
+ *
+ * @param size The size of the push constant block in byte, before build()
+ */
+void stdEng::setPushConstantSize(uint32_t size) {
+  if (this->built) {
+    cout << "Push constant size must be set before build!" << endl;
+    return;
+  }
+  if (size > this->pushData.size())
+    this->pushData.resize(size);
+}
+
+/* Raw form of setPushConstants
+ *
+ * @param data The bytes to copy
+ * @param size Their number
+ * @param offset Where they go in the push constant block
+ */
+void stdEng::setPushConstantData(const void *data, uint32_t size,
+                                 uint32_t offset) {
+  if (offset + size > this->pushData.size()) {
+    if (this->built) {
+      cout << "Push constants out of the declared range!" << endl;
+      delete this;
+      exit(EXIT_FAILURE);
+    }
+    this->pushData.resize(offset + size);
+  }
+  memcpy(this->pushData.data() + offset, data, size);
+}
+
+/* Where autotune() stores its results and build() looks them up, by default
+ * autotune.txt in the pipeline cache directory
+ *
+ * @param tuneFile The path of the file
+ */
+void stdEng::setAutotuneFile(const char *tuneFile) {
+  this->tuneFile = tuneFile;
+}
+
+/* The specialization constant the kernel reads as the number of elements one
+ * invocation handles in x. autotune() sweeps it with the local size and the
+ * number of workgroups is divided by it.
+ *
+ * @param id The constant_id of the tile factor in the shader
+ */
+void stdEng::setTileConstant(uint32_t id) { this->tileId = id; }
+
+// true when build() took the local size from a stored autotune result
+bool stdEng::isAutotuned() { return this->tuned; }
+
+/* Sweep the local sizes, and the tile factors when setTileConstant was called,
+ * that fit maxComputeWorkGroupSize and maxComputeWorkGroupInvocations. Time
+ * each with gpu timestamps and keep the fastest. The result is applied to the
+ * engine and saved, so the next build() of this kernel on this device with
+ * the same element count uses it without tuning again.
+ *
+ * Needs setElementCount. The inputs are not uploaded, the kernel runs on
+ * whatever the buffers hold.
+ *
+ * @param iterations Timed runs per candidate, the fastest one counts
+ * @return the best launch shape and its gpu time
+ */
+tuneEntry stdEng::autotune(uint32_t iterations) {
+  if (!this->built)
+    this->build();
+  tuneEntry best;
+  if (!this->elemCount[0]) {
+    cout << "Autotune needs setElementCount!" << endl;
+    return best;
+  }
+  this->waitIdle();
+  PhysicalDeviceLimits limits = this->physdev.getProperties().limits;
+  QueryPool queryPool;
+  if (this->physdev.getQueueFamilyProperties()[this->queueFamIndex]
+          .timestampValidBits)
+    queryPool = this->dev.createQueryPool(
+        QueryPoolCreateInfo(QueryPoolCreateFlags(), QueryType::eTimestamp, 2));
+
+  // powers of two per dimension, no larger than the elements need
+  vector<uint32_t> sizes[3];
+  for (uint32_t d = 0; d < 3; ++d) {
+    uint32_t need = 1;
+    while (need < this->elemCount[d])
+      need *= 2;
+    for (uint32_t s = 1; s <= limits.maxComputeWorkGroupSize[d] && s <= need;
+         s *= 2)
+      sizes[d].push_back(s);
+  }
+  vector<uint32_t> tiles = {1};
+  if (this->tileId != uint32_t(~0))
+    tiles = {1, 2, 4, 8, 16};
+  uint32_t minInvocations = min(32u, limits.maxComputeWorkGroupInvocations);
+
+  uint32_t oldLocal[3];
+  copy(this->localSize, this->localSize + 3, oldLocal);
+  map<uint32_t, uint32_t> oldConsts = this->specConsts;
+  auto oldVariants = this->variants;
+  best.gpuTime = ~0ull;
+  for (uint32_t x : sizes[0])
+    for (uint32_t y : sizes[1])
+      for (uint32_t z : sizes[2]) {
+        uint64_t invocations = uint64_t(x) * y * z;
+        if (invocations > limits.maxComputeWorkGroupInvocations ||
+            (invocations < minInvocations && !(x == sizes[0].back() &&
+                                               y == sizes[1].back() &&
+                                               z == sizes[2].back())))
+          continue;
+        for (uint32_t tile : tiles) {
+          this->setLocalSize(x, y, z);
+          if (this->tileId != uint32_t(~0))
+            this->specConsts[this->tileId] = tile;
+          this->pipe = this->pipelineVariant();
+          uint64_t ns = this->timeDispatch(queryPool, iterations);
+          if (!(this->debugMode == DebugMode::NO))
+            cout << "Autotune local size " << x << "x" << y << "x" << z
+                 << " tile " << tile << " = " << ns << " ns" << endl;
+          if (ns < best.gpuTime) {
+            best.localSize[0] = x;
+            best.localSize[1] = y;
+            best.localSize[2] = z;
+            best.tile = tile;
+            best.gpuTime = ns;
+          }
+        }
+      }
+  if (queryPool)
+    this->dev.destroyQueryPool(queryPool);
+  // once for every candidate pipeline
+  this->pipeCache.save();
+  if (best.gpuTime == ~0ull) {
+    copy(oldLocal, oldLocal + 3, this->localSize);
+    this->specConsts = oldConsts;
+    this->pipe = this->pipelineVariant();
+    return tuneEntry();
+  }
+
+  this->setLocalSize(best.localSize[0], best.localSize[1], best.localSize[2]);
+  if (this->tileId != uint32_t(~0))
+    this->specConsts[this->tileId] = best.tile;
+  this->pipe = this->pipelineVariant();
+  // keep the variants of before and the winner, drop the other candidates
+  for (auto it = this->variants.begin(); it != this->variants.end();) {
+    if (it->second != this->pipe && !oldVariants.count(it->first)) {
+      this->dev.destroyPipeline(it->second);
+      it = this->variants.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  string path = this->tunePath();
+  if (!path.empty()) {
+    this->tuning.open(this->physdev, path);
+    this->tuning.store(this->kernelHash(), this->elemCount, best);
+    this->tuning.save();
+  }
+  return best;
+}
+
+// time spent in createComputePipeline in nanoseconds
+uint64_t stdEng::getPipelineCompileTime() { return this->pipeCompileTime; }
+
+/* Create the pipelines of several entry points or specializations of the
+ * module at once, on a pool of threads that all feed the one pipeline cache
+ * of the engine, which is saved once at the end. Switching to one of them
+ * later with setEntryPoint or setSpecConstant costs a lookup only. Call it
+ * after build().
+ *
+ * @param kernels The variants to create, the ones the engine has are skipped
+ * @param threads Threads creating pipelines, 0 for one per hardware thread.
+ * With 1 they are created one after another on the calling thread.
+ * @return how many were created and the wall time it took
+ */
+pipelineBuildStats stdEng::createPipelines(const vector<kernelVariant> &kernels,
+                                           uint32_t threads) {
+  pipelineBuildStats stats;
+  if (!this->built) {
+    cout << "Pipelines must be created after build!" << endl;
+    return stats;
+  }
+  auto start = chrono::steady_clock::now();
+  vector<pair<string, vector<uint32_t>>> keys;
+  for (const kernelVariant &k : kernels) {
+    pair<string, vector<uint32_t>> key(k.entryPoint,
+                                       specKey(k.specConsts, k.localSize));
+    if (!this->variants.count(key) &&
+        find(keys.begin(), keys.end(), key) == keys.end())
+      keys.push_back(key);
+  }
+  if (!threads)
+    threads = max(thread::hardware_concurrency(), 1u);
+  threads = uint32_t(min<size_t>(threads, keys.size()));
+
+  // the calling thread is one of the workers
+  vector<Pipeline> pipes(keys.size());
+  vector<Result> results(keys.size(), Result::eSuccess);
+  atomic<size_t> next{0};
+  auto work = [&]() {
+    for (size_t i = next.fetch_add(1); i < keys.size(); i = next.fetch_add(1))
+      pipes.at(i) = this->createVariant(keys.at(i).first.c_str(),
+                                        keys.at(i).second, results.at(i),
+                                        nullptr);
+  };
+  vector<thread> workers;
+  for (uint32_t t = 1; t < threads; ++t)
+    workers.emplace_back(work);
+  work();
+  for (thread &worker : workers)
+    worker.join();
+
+  bool failed = false;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (results.at(i) == Result::eSuccess)
+      this->variants[keys.at(i)] = pipes.at(i);
+    else
+      failed = true;
+  }
+  if (failed) {
+    cout << "Failed to create pipeline" << endl;
+    delete this;
+    exit(EXIT_FAILURE);
+  }
+  this->pipeCache.save();
+  auto finish = chrono::steady_clock::now();
+  tracer::span("createPipelines", start, finish);
+  stats.pipelines = uint32_t(keys.size());
+  stats.threads = threads;
+  stats.nanoseconds =
+      chrono::duration_cast<chrono::nanoseconds>(finish - start).count();
+  return stats;
+}
+
+// true when the pipeline was created from a cache file of a previous run
+bool stdEng::isPipelineCacheWarm() { return this->pipeCache.isWarm(); }
+
 // get current debug mode
 DebugMode stdEng::getDebugMode() { return this->debugMode; }
 
@@ -118,39 +618,60 @@ void stdEng::setDebugMode(DebugMode debugMode) { this->debugMode = debugMode; }
 // akhir dari metode public
 
 // metode private
-// Create device from the instance
+/* Open the device of the context, or take the one it has, and copy what the
+ * engine needs of it
+ */
 void stdEng::createDevice() {
-  if (!this->inst) {
-    cout << "Instance not created yet!" << endl;
+  uint32_t wanted =
+      this->queueCount ? this->queueCount : this->framesInFlight;
+  if (!this->ctx->open(this->physdevIndex, wanted, this->priority)) {
     delete this;
     exit(EXIT_FAILURE);
   }
-  vector<PhysicalDevice> physdevs = this->inst.enumeratePhysicalDevices();
-  if (physdevs.empty()) {
-    cout << "No Vulkan driver found!" << endl;
-    delete this;
-    exit(EXIT_FAILURE);
+  sharedContext &ctx = *this->ctx;
+  this->physdev = ctx.physdev;
+  this->dev = ctx.dev;
+  this->dld = ctx.dld;
+  this->devQInfo = ctx.devQInfo;
+  this->devInfo = ctx.devInfo;
+  // the device may have been opened by an engine that wanted fewer queues
+  this->queueFamIndex = ctx.queueFamIndex;
+  this->queueCount = max(min(wanted, ctx.queueCount), 1u);
+  this->transferFamIndex = ctx.transferFamIndex;
+  this->transferQueueCount =
+      max(min(this->queueCount, ctx.transferQueueCount), 1u);
+  this->hostImport = ctx.hostImport;
+  this->hostImportAlign = ctx.hostImportAlign;
+  this->addressCore = ctx.addressCore;
+  if (this->addressMode && !ctx.address) {
+    this->addressMode = false;
+    if (!(this->debugMode == DebugMode::NO))
+      cout << "No buffer device address, using descriptor sets" << endl;
   }
-  this->physdev = PhysicalDevice(physdevs[0]);
-  vector<QueueFamilyProperties> qFamProps =
-      this->physdev.getQueueFamilyProperties();
-  auto qFamProp = find_if(
-      qFamProps.begin(), qFamProps.end(), [](QueueFamilyProperties qFamPropsT) {
-        return qFamPropsT.queueFlags & QueueFlagBits::eCompute;
-      });
-  this->queueFamIndex = distance(qFamProps.begin(), qFamProp);
-  if (this->queueFamIndex == qFamProps.size()) {
-    cout << "No Queue Family found!" << endl;
-    delete this;
-    exit(EXIT_FAILURE);
-  }
-  DeviceQueueCreateInfo devQInfo(DeviceQueueCreateFlags(), this->queueFamIndex,
-                                 1, &this->priority);
-  this->devQInfo = devQInfo;
-  DeviceCreateInfo devInfo({}, devQInfo);
-  this->devInfo = devInfo;
-  Device dev = physdev.createDevice(devInfo);
-  this->dev = dev;
+  this->arena.init(this->physdev, this->dev);
+  if (this->addressMode)
+    this->arena.setAllocateFlags(MemoryAllocateFlagBits::eDeviceAddress);
+}
+
+/* AUTO placement, decided from the heap flags
+ *
+ * On UMA devices every heap is DEVICE_LOCAL and the host reaches it directly,
+ * a staging copy would only add work. A heap without DEVICE_LOCAL means the
+ * device has memory of its own behind a bus, so the buffers go there.
+ */
+bool stdEng::useDeviceLocal() {
+  if (this->placement != MemoryPlacement::AUTO)
+    return this->placement == MemoryPlacement::DEVICE_LOCAL;
+  PhysicalDeviceMemoryProperties memProps = this->physdev.getMemoryProperties();
+  for (uint32_t i = 0; i < memProps.memoryHeapCount; ++i)
+    if (!(memProps.memoryHeaps[i].flags & MemoryHeapFlagBits::eDeviceLocal))
+      return true;
+  return false;
+}
+
+// copies go to their own queue and are chained with semaphores
+bool stdEng::dedicatedTransfer() {
+  return this->deviceLocal && this->transferFamIndex != this->queueFamIndex;
 }
 
 // creating buffers for input and output
@@ -160,107 +681,277 @@ void stdEng::createBuffer() {
     delete this;
     exit(EXIT_FAILURE);
   }
+  this->deviceLocal = this->useDeviceLocal();
+  this->buffFamIndices = {this->queueFamIndex};
+  if (this->dedicatedTransfer())
+    this->buffFamIndices.push_back(this->transferFamIndex);
+  BufferUsageFlags usage = BufferUsageFlagBits::eStorageBuffer |
+                           BufferUsageFlagBits::eTransferSrc |
+                           BufferUsageFlagBits::eTransferDst;
+  if (this->addressMode)
+    usage |= BufferUsageFlagBits::eShaderDeviceAddress;
   for (size_t insize : this->insizes) {
-    BufferCreateInfo inBuffInfo(BufferCreateFlags(), insize,
-                                BufferUsageFlagBits::eStorageBuffer,
+    // transfer usage lets defragmentMemory() copy the buffer
+    BufferCreateInfo inBuffInfo(BufferCreateFlags(), insize, usage,
                                 SharingMode::eExclusive);
+    tracer::counter("input buffer bytes", insize);
+    if (this->buffFamIndices.size() > 1)
+      inBuffInfo.setSharingMode(SharingMode::eConcurrent)
+          .setQueueFamilyIndices(this->buffFamIndices);
     this->inBuffInfos.push_back(inBuffInfo);
-    Buffer inbuff = this->dev.createBuffer(inBuffInfo);
-    this->inBuffs.push_back(inbuff);
   }
   for (size_t outsize : this->outsizes) {
-    BufferCreateInfo outBuffInfo(BufferCreateFlags(), outsize,
-                                 BufferUsageFlagBits::eStorageBuffer,
+    BufferCreateInfo outBuffInfo(BufferCreateFlags(), outsize, usage,
                                  SharingMode::eExclusive);
+    tracer::counter("output buffer bytes", outsize);
+    if (this->buffFamIndices.size() > 1)
+      outBuffInfo.setSharingMode(SharingMode::eConcurrent)
+          .setQueueFamilyIndices(this->buffFamIndices);
     this->outBuffInfos.push_back(outBuffInfo);
-    Buffer outbuff = this->dev.createBuffer(outBuffInfo);
-    this->outBuffs.push_back(outbuff);
+  }
+  // every frame in flight has buffers of its own
+  this->frames.resize(this->framesInFlight);
+  for (frame &f : this->frames) {
+    for (BufferCreateInfo &inBuffInfo : this->inBuffInfos)
+      f.inBuffs.push_back(this->dev.createBuffer(inBuffInfo));
+    for (BufferCreateInfo &outBuffInfo : this->outBuffInfos)
+      f.outBuffs.push_back(this->dev.createBuffer(outBuffInfo));
+    f.inHostPtrs.assign(f.inBuffs.size(), nullptr);
+    f.inImported.assign(f.inBuffs.size(), DeviceMemory());
   }
 }
 
 // Memory allocations for input and output
 void stdEng::allocateMemory() {
-  for (Buffer inbuff : this->inBuffs) {
+  // the buffers of the other frames were created from the same infos
+  for (Buffer inbuff : this->frames.front().inBuffs) {
     MemoryRequirements inMemReq = this->dev.getBufferMemoryRequirements(inbuff);
     this->inMemReqs.push_back(inMemReq);
   }
-  for (Buffer outbuff : this->outBuffs) {
+  for (Buffer outbuff : this->frames.front().outBuffs) {
     MemoryRequirements outMemReq =
         this->dev.getBufferMemoryRequirements(outbuff);
     this->outMemReqs.push_back(outMemReq);
   }
-  PhysicalDeviceMemoryProperties heapMemProp =
-      this->physdev.getMemoryProperties();
-  DeviceSize heapIndex = uint32_t(~0);
-  for (uint32_t i = 0; i < heapMemProp.memoryTypeCount; ++i) {
-    if ((heapMemProp.memoryTypes[i].propertyFlags &
-         MemoryPropertyFlagBits::eHostVisible) &&
-        (heapMemProp.memoryTypes[i].propertyFlags &
-         MemoryPropertyFlagBits::eHostCoherent)) {
-      heapIndex = i;
-      break;
-    }
+  // every buffer has the same usage, so one memory type fits them all
+  uint32_t typeBits = ~0u;
+  for (MemoryRequirements memReq : this->inMemReqs)
+    typeBits &= memReq.memoryTypeBits;
+  for (MemoryRequirements memReq : this->outMemReqs)
+    typeBits &= memReq.memoryTypeBits;
+  this->memTypeIndex = uint32_t(~0);
+  if (this->deviceLocal)
+    this->memTypeIndex = this->arena.findMemoryType(
+        typeBits, MemoryPropertyFlagBits::eDeviceLocal);
+  // UMA devices and forced HOST_VISIBLE, also the fallback when no device
+  // local type fits the buffers
+  if (this->memTypeIndex == uint32_t(~0)) {
+    this->deviceLocal = false;
+    this->memTypeIndex = this->arena.findMemoryType(
+        typeBits, MemoryPropertyFlagBits::eHostVisible |
+                      MemoryPropertyFlagBits::eHostCoherent);
   }
-  if (heapIndex == uint32_t(~0)) {
+  if (this->memTypeIndex == uint32_t(~0)) {
     cout << "No heap found" << endl;
     delete this;
     exit(EXIT_FAILURE);
   }
-  int inCount = 0, outCount = 0;
-  for (MemoryRequirements inMemReq : this->inMemReqs) {
-    inCount++;
-    MemoryAllocateInfo inMemAllocInfo(inMemReq.size, heapIndex);
-    this->inMemAllocInfos.push_back(inMemAllocInfo);
-    DeviceMemory inmem = this->dev.allocateMemory(inMemAllocInfo);
-    this->inMems.push_back(inmem);
-  }
-  for (MemoryRequirements outMemReq : this->outMemReqs) {
-    outCount++;
-    MemoryAllocateInfo outMemAllocInfo(outMemReq.size, heapIndex);
-    this->outMemAllocInfos.push_back(outMemAllocInfo);
-    DeviceMemory outmem = this->dev.allocateMemory(outMemAllocInfo);
-    this->outMems.push_back(outmem);
-  }
-  cout << "inCount and outCount = " << inCount << "," << outCount << endl;
-}
-
-// fill the memories with our inputs data in byte
-void stdEng::fillInputs() {
-  if (this->inMems.empty() || this->inputs.empty()) {
-    if (this->inMems.empty())
-      cout << "No input memory has been set!" << endl;
-    if (this->inputs.empty())
-      cout << "No input data has been set!" << endl;
+  /* the host reads host visible outputs, uncached memory makes that many
+   * times slower. Cached memory may be non coherent, then the output ranges
+   * are aligned to nonCoherentAtomSize and invalidated before every read.
+   */
+  this->outMemTypeIndex = this->memTypeIndex;
+  if (!this->deviceLocal) {
+    uint32_t cached = this->arena.findMemoryType(
+        typeBits, MemoryPropertyFlagBits::eHostVisible |
+                      MemoryPropertyFlagBits::eHostCached,
+        MemoryPropertyFlagBits::eHostCoherent);
+    if (cached != uint32_t(~0))
+      this->outMemTypeIndex = cached;
+  }
+  this->outCoherent =
+      bool(this->physdev.getMemoryProperties()
+               .memoryTypes[this->outMemTypeIndex]
+               .propertyFlags &
+           MemoryPropertyFlagBits::eHostCoherent);
+  this->atomSize = this->physdev.getProperties().limits.nonCoherentAtomSize;
+  for (frame &f : this->frames) {
+    for (size_t i = 0; i < f.inBuffs.size(); ++i) {
+      memAlloc alloc =
+          this->arena.allocate(this->inMemReqs.at(i), this->memTypeIndex);
+      this->dev.bindBufferMemory(f.inBuffs.at(i), alloc.mem, alloc.offset);
+      f.inAllocs.push_back(alloc);
+    }
+    for (size_t i = 0; i < f.outBuffs.size(); ++i) {
+      MemoryRequirements memReq = this->outMemReqs.at(i);
+      if (!this->outCoherent) {
+        memReq.alignment = max(memReq.alignment, this->atomSize);
+        memReq.size = (memReq.size + this->atomSize - 1) / this->atomSize *
+                      this->atomSize;
+      }
+      memAlloc alloc = this->arena.allocate(memReq, this->outMemTypeIndex);
+      this->dev.bindBufferMemory(f.outBuffs.at(i), alloc.mem, alloc.offset);
+      f.outAllocs.push_back(alloc);
+    }
+  }
+  if (this->deviceLocal) {
+    DeviceSize ioSize = 0;
+    for (size_t insize : this->insizes)
+      ioSize += insize + 256;
+    for (size_t outsize : this->outsizes)
+      ioSize += outsize + 256;
+    // every frame in flight plus the next inputs of the oldest one
+    this->staging.create(this->physdev, this->dev,
+                         max(this->stagingSize,
+                             (this->framesInFlight + 1) * ioSize),
+                         this->buffFamIndices);
+  }
+}
+
+/* Reserve the staging ranges of the next submission of frame f, once per
+ * submission. The ranges of its previous submission stay valid until this one
+ * is submitted, so those outputs can still be read while the inputs are
+ * written.
+ */
+void stdEng::stageIO(frame &f) {
+  if (!this->deviceLocal || f.staged)
+    return;
+  // recorded copies point at fixed ranges, they are never released
+  if (this->reuseCommands && !f.inStageOffsets.empty()) {
+    f.pendingInOffsets = f.inStageOffsets;
+    f.pendingOutOffsets = f.outStageOffsets;
+    f.pendingEnd = DeviceSize(~0);
+    f.staged = true;
+    return;
+  }
+  f.pendingInOffsets.clear();
+  f.pendingOutOffsets.clear();
+  for (size_t i = 0; i < this->insizes.size(); ++i)
+    f.pendingInOffsets.push_back(
+        f.inImported.at(i) ? 0 : this->staging.reserve(this->insizes.at(i)));
+  for (size_t outsize : this->outsizes)
+    f.pendingOutOffsets.push_back(this->staging.reserve(outsize));
+  if (count(f.pendingInOffsets.begin(), f.pendingInOffsets.end(),
+            DeviceSize(~0)) ||
+      count(f.pendingOutOffsets.begin(), f.pendingOutOffsets.end(),
+            DeviceSize(~0))) {
+    cout << "Staging ring too small!" << endl;
+    delete this;
+    exit(EXIT_FAILURE);
+  }
+  f.pendingEnd = this->staging.mark();
+  f.staged = true;
+}
+
+/* The frame the next submission uses. Its previous submission must be done
+ * before the host writes into it, with every frame in flight this is where
+ * the host waits for the gpu.
+ */
+stdEng::frame &stdEng::acquireFrame() {
+  if (!this->built) {
+    cout << "Engine not built yet!" << endl;
     delete this;
     exit(EXIT_FAILURE);
   }
-  for (size_t i = 0; i < this->inputs.size(); ++i) {
-    void *inPtr =
-        this->dev.mapMemory(this->inMems.at(i), 0, this->insizes.at(i));
-    memcpy(inPtr, this->inputs.at(i).data(), this->insizes.at(i));
-    this->dev.unmapMemory(this->inMems.at(i));
+  this->waitFrame(this->curFrame, uint64_t(-1));
+  return this->frames.at(this->curFrame);
+}
+
+// host address the next submission reads input i from
+void *stdEng::inputData(size_t i) {
+  frame &f = this->acquireFrame();
+  if (f.inHostPtrs.at(i))
+    return f.inHostPtrs.at(i);
+  if (this->deviceLocal) {
+    this->stageIO(f);
+    if (f.inWrittenOffsets.size() < this->insizes.size())
+      f.inWrittenOffsets.resize(this->insizes.size(), DeviceSize(~0));
+    f.inWrittenOffsets.at(i) = f.pendingInOffsets.at(i);
+    return this->staging.data(f.pendingInOffsets.at(i));
+  }
+  return f.inAllocs.at(i).mapped;
+}
+
+/* fill the memories of frame f with our inputs data in byte
+ *
+ * The memory stays mapped, so only inputs given with setInputs since the last
+ * submission of the frame are copied. Inputs written through inputSpan are
+ * already there. With device local memory every submission may get new
+ * staging ranges, an input is copied again whenever its range was not written
+ * for this submission.
+ */
+void stdEng::fillInputs(frame &f) {
+  if (f.inAllocs.empty()) {
+    cout << "No input memory has been set!" << endl;
+    delete this;
+    exit(EXIT_FAILURE);
+  }
+  this->stageIO(f);
+  // each frame has its own copy of the inputs given with setInputs
+  bool fresh = f.inputsGen == this->inputsGen;
+  for (size_t i = this->streaming ? 1 : 0;
+       i < this->inputs.size() && i < this->insizes.size(); ++i) {
+    bool written =
+        !this->deviceLocal || f.inHostPtrs.at(i) ||
+        (i < f.inWrittenOffsets.size() &&
+         f.inWrittenOffsets.at(i) == f.pendingInOffsets.at(i));
+    if (!fresh || !written)
+      memcpy(this->inputData(i), this->inputs.at(i).data(),
+             this->insizes.at(i));
+  }
+  f.inputsGen = this->inputsGen;
+  if (this->deviceLocal) {
+    /* the previous submission of this frame completed and it is the oldest
+     * one in the ring, since frames are submitted round robin
+     */
+    if (f.stageEnd != DeviceSize(~0) && f.pendingEnd != DeviceSize(~0))
+      this->staging.release(f.stageEnd);
+    f.inStageOffsets = f.pendingInOffsets;
+    f.outStageOffsets = f.pendingOutOffsets;
+    f.stageEnd = f.pendingEnd;
+    f.staged = false;
   }
 }
 
 // load SPIR-V shader
 void stdEng::loadShader() {
   vector<char> shaderRaw;
-  ifstream shaderFile(this->filepath, ios::ate | ios::binary);
-  if (!shaderFile) {
-    cout << "Failed to open shader file" << endl;
-    delete this;
-    exit(EXIT_FAILURE);
+  const uint32_t *words = this->shadCode;
+  size_t shaderSize = this->shadCodeSize;
+  if (!words) {
+    ifstream shaderFile(this->filepath, ios::ate | ios::binary);
+    if (!shaderFile) {
+      cout << "Failed to open shader file" << endl;
+      delete this;
+      exit(EXIT_FAILURE);
+    }
+    shaderSize = shaderFile.tellg();
+    shaderFile.seekg(0);
+    shaderRaw.resize(shaderSize);
+    shaderFile.read(shaderRaw.data(), shaderSize);
+    shaderFile.close();
+    words = reinterpret_cast<const uint32_t *>(shaderRaw.data());
   }
-  size_t shaderSize = shaderFile.tellg();
-  shaderFile.seekg(0);
-  shaderRaw.resize(shaderSize);
-  shaderFile.read(shaderRaw.data(), shaderSize);
-  shaderFile.close();
 
-  ShaderModuleCreateInfo shadModInfo(
-      ShaderModuleCreateFlags(), shaderSize,
-      reinterpret_cast<const uint32_t *>(shaderRaw.data()));
-  ShaderModule shadMod = this->dev.createShaderModule(shadModInfo);
+  ShaderModuleCreateInfo shadModInfo(ShaderModuleCreateFlags(), shaderSize,
+                                     words);
+  this->shadHash = hashBytes(words, shaderSize);
+  ShaderModule shadMod =
+      shaderCache::acquire(this->dev, words, shaderSize, this->shadHash);
+
+  /* the LocalSize execution mode is the size when it is not specialized,
+   * OpExecutionMode is opcode 16 and LocalSize is mode 17
+   */
+  for (size_t i = 5; i < shaderSize / 4;) {
+    uint32_t wordCount = words[i] >> 16, opcode = words[i] & 0xffff;
+    if (!wordCount || i + wordCount > shaderSize / 4)
+      break;
+    if (opcode == 16 && wordCount >= 6 && words[i + 2] == 17) {
+      copy(words + i + 3, words + i + 6, this->shadLocalSize);
+      break;
+    }
+    i += wordCount;
+  }
   this->shadModInfo = shadModInfo;
   this->shadMod = shadMod;
 }
@@ -273,32 +964,46 @@ void stdEng::createDescriptorSetLayout() {
     delete this;
     exit(EXIT_FAILURE);
   }
+  // every set has its own layout, each binding is one storage buffer
   for (uint32_t setI = 0; setI < this->bindings.size(); ++setI) {
     sumBind += this->bindings.at(setI);
+    vector<DescriptorSetLayoutBinding> descSetLayBinds;
     for (uint32_t bindI = 0; bindI < this->bindings.at(setI); ++bindI) {
       DescriptorSetLayoutBinding descSetLayBind(
-          bindI, DescriptorType::eStorageBuffer, setI,
+          bindI, DescriptorType::eStorageBuffer, 1,
           ShaderStageFlagBits::eCompute);
+      descSetLayBinds.push_back(descSetLayBind);
       this->descSetLayBinds.push_back(descSetLayBind);
     }
+    DescriptorSetLayoutCreateInfo descSetLayInfo(
+        DescriptorSetLayoutCreateFlags(), descSetLayBinds);
+    this->descSetLays.push_back(
+        this->dev.createDescriptorSetLayout(descSetLayInfo));
   }
   // save the amount of the binding which used later in DescriptorPool
   this->sumBind = sumBind;
-  vector<DescriptorSetLayoutBinding> descSetLayBinds;
-  for (DescriptorSetLayoutBinding descSetLayBind : this->descSetLayBinds)
-    descSetLayBinds.push_back(descSetLayBind);
-  DescriptorSetLayoutCreateInfo descSetLayInfo(DescriptorSetLayoutCreateFlags(),
-                                               descSetLayBinds);
-  this->descSetLayInfo = descSetLayInfo;
-  DescriptorSetLayout descSetLay =
-      this->dev.createDescriptorSetLayout(descSetLayInfo);
-  this->descSetLay = descSetLay;
 }
 
 // Create Pipeline Layout for binding to the Pipeline
 void stdEng::createPipelineLayout() {
   PipelineLayoutCreateInfo pipeLayInfo(PipelineLayoutCreateFlags(),
-                                       this->descSetLay);
+                                       this->descSetLays);
+  // in address mode the buffer addresses come first
+  uint32_t pushSize = this->addressBytes() + uint32_t(this->pushData.size());
+  if (pushSize) {
+    uint32_t maxSize =
+        this->physdev.getProperties().limits.maxPushConstantsSize;
+    if (pushSize > maxSize) {
+      cout << "Push constants are " << pushSize
+           << " bytes, the device allows " << maxSize << endl;
+      delete this;
+      exit(EXIT_FAILURE);
+    }
+    this->pushRange =
+        PushConstantRange(ShaderStageFlagBits::eCompute, 0, pushSize);
+    pipeLayInfo = PipelineLayoutCreateInfo(PipelineLayoutCreateFlags(),
+                                           this->descSetLays, this->pushRange);
+  }
   PipelineLayout pipeLay = this->dev.createPipelineLayout(pipeLayInfo);
   this->pipeLayInfo = pipeLayInfo;
   this->pipeLay = pipeLay;
@@ -306,162 +1011,696 @@ void stdEng::createPipelineLayout() {
 
 // Create Pipeline for the Shader
 void stdEng::createPipeline() {
+  this->pipeCache.open(this->physdev, this->dev, this->cacheDir,
+                       this->shadHash);
+  auto start = chrono::steady_clock::now();
+  this->pipe = this->pipelineVariant();
+  this->pipeCompileTime = chrono::duration_cast<chrono::nanoseconds>(
+                              chrono::steady_clock::now() - start)
+                              .count();
+}
+
+/* The pipeline of the current entry point and specialization constants,
+ * created on first use and kept, so switching back and forth costs a lookup
+ * only
+ */
+Pipeline stdEng::pipelineVariant() {
+  pair<string, vector<uint32_t>> key(this->entryPoint, this->specKey());
+  auto found = this->variants.find(key);
+  if (found != this->variants.end())
+    return found->second;
+
+  Result result;
+  Pipeline pipe =
+      this->createVariant(this->entryPoint, key.second, result,
+                          &this->compPipeInfo);
+  if (result != Result::eSuccess) {
+    cout << "Failed to create pipeline" << endl;
+    delete this;
+    exit(EXIT_FAILURE);
+  }
+  this->pipeShadStagInfo = this->compPipeInfo.stage;
+  // the cache file is written after build(), autotune() and on destruction
+  this->variants[key] = pipe;
+  return pipe;
+}
+
+/* One compute pipeline of the module, through the pipeline cache. Changes
+ * nothing in the engine so several threads may call it at once, the cache
+ * is internally synchronized.
+ *
+ * @param key (id, value) pairs of the specialization constants, see specKey
+ * @param info Gets the create info when not null, its pointers do not live
+ * past the call
+ */
+Pipeline stdEng::createVariant(const char *entryPoint,
+                               const vector<uint32_t> &key, Result &result,
+                               ComputePipelineCreateInfo *info) {
+  vector<SpecializationMapEntry> specEntries;
+  vector<uint32_t> specData;
+  for (size_t i = 0; i < key.size(); i += 2) {
+    specEntries.push_back(SpecializationMapEntry(
+        key[i], uint32_t(specData.size() * sizeof(uint32_t)),
+        sizeof(uint32_t)));
+    specData.push_back(key[i + 1]);
+  }
+  SpecializationInfo specInfo(uint32_t(specEntries.size()), specEntries.data(),
+                              specData.size() * sizeof(uint32_t),
+                              specData.data());
   PipelineShaderStageCreateInfo pipeShadStagInfo(
       PipelineShaderStageCreateFlags(), ShaderStageFlagBits::eCompute,
-      (this->shadMod), this->entryPoint);
-  this->pipeShadStagInfo = pipeShadStagInfo;
-  PipelineCache pipeCache =
-      this->dev.createPipelineCache(PipelineCacheCreateInfo());
+      (this->shadMod), entryPoint,
+      specEntries.empty() ? nullptr : &specInfo);
   ComputePipelineCreateInfo compPipeInfo(PipelineCreateFlags(),
                                          pipeShadStagInfo, this->pipeLay);
-  this->compPipeInfo = compPipeInfo;
-  ResultValue res = this->dev.createComputePipeline(pipeCache, compPipeInfo);
-  if (res.result != Result::eSuccess) {
-    cout << "Failed to create pipeline" << endl;
-    delete this;
-    exit(EXIT_FAILURE);
+  if (info)
+    *info = compPipeInfo;
+  ResultValue res =
+      this->dev.createComputePipeline(this->pipeCache.get(), compPipeInfo);
+  result = res.result;
+  return res.value;
+}
+
+// the current specialization constants as (id, value) pairs in id order
+vector<uint32_t> stdEng::specKey() {
+  return specKey(this->specConsts, this->localSize);
+}
+
+// the local size goes to the constants 0, 1 and 2 when its x is set
+vector<uint32_t> stdEng::specKey(const map<uint32_t, uint32_t> &specConsts,
+                                 const uint32_t localSize[3]) {
+  map<uint32_t, uint32_t> consts = specConsts;
+  for (uint32_t i = 0; i < 3; ++i)
+    if (localSize[0])
+      consts[i] = localSize[i];
+  vector<uint32_t> key;
+  for (auto &c : consts) {
+    key.push_back(c.first);
+    key.push_back(c.second);
   }
-  Pipeline pipe =
-      this->dev.createComputePipeline(pipeCache, compPipeInfo).value;
-  this->pipe = pipe;
+  return key;
+}
+
+/* the number of workgroups, from the element count and the local size once
+ * setElementCount was called, setWorkgroupSize otherwise. With a tile
+ * constant every invocation covers tile elements in x.
+ */
+void stdEng::groupCount(uint32_t groups[3]) {
+  if (!this->elemCount[0]) {
+    groups[0] = this->width;
+    groups[1] = this->height;
+    groups[2] = this->depth;
+    return;
+  }
+  auto tile = this->specConsts.find(this->tileId);
+  for (uint32_t i = 0; i < 3; ++i) {
+    uint32_t local =
+        this->localSize[0] ? this->localSize[i] : this->shadLocalSize[i];
+    local = max(local, 1u);
+    if (i == 0 && tile != this->specConsts.end())
+      local *= max(tile->second, 1u);
+    groups[i] = (max(this->elemCount[i], 1u) + local - 1) / local;
+  }
+}
+
+// the kernel autotune results are keyed by, the SPIR-V and the entry point
+uint64_t stdEng::kernelHash() {
+  return hashBytes(this->entryPoint, strlen(this->entryPoint), this->shadHash);
+}
+
+// the autotune file, next to the pipeline cache files when there are some
+string stdEng::tunePath() {
+  if (this->tuneFile)
+    return this->tuneFile;
+  if (this->cacheDir)
+    return (filesystem::path(this->cacheDir) / "autotune.txt").string();
+  return string();
+}
+
+/* Use the launch shape a previous autotune() stored for this device, kernel
+ * and element count. A local size or tile set by the caller wins.
+ */
+void stdEng::applyTuning() {
+  string path = this->tunePath();
+  if (path.empty() || !this->elemCount[0])
+    return;
+  this->tuning.open(this->physdev, path);
+  tuneEntry entry;
+  if (this->localSize[0] ||
+      !this->tuning.find(this->kernelHash(), this->elemCount, entry))
+    return;
+  copy(entry.localSize, entry.localSize + 3, this->localSize);
+  if (this->tileId != uint32_t(~0) && !this->specConsts.count(this->tileId))
+    this->specConsts[this->tileId] = entry.tile;
+  this->tuned = true;
 }
 
-// Create Descriptor Pool for binding to the DescriptorSet
+/* Best gpu time of one dispatch with the current pipeline, in nanoseconds.
+ * Measured with timestamps around the dispatch, or on the host around the
+ * submit when the queue has no timestamps. The first run is a warm up.
+ */
+uint64_t stdEng::timeDispatch(QueryPool queryPool, uint32_t iterations) {
+  frame &f = this->frames.front();
+  CommandBuffer cmdBuff = f.cmdBuffs.front();
+  uint32_t groups[3];
+  this->groupCount(groups);
+  double period = this->physdev.getProperties().limits.timestampPeriod;
+  uint32_t validBits =
+      this->physdev.getQueueFamilyProperties()[this->queueFamIndex]
+          .timestampValidBits;
+  uint64_t mask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+  uint64_t best = ~0ull;
+  for (uint32_t it = 0; it <= iterations; ++it) {
+    this->dev.resetCommandPool(f.cmdPool);
+    f.recorded = false;
+    cmdBuff.begin(
+        CommandBufferBeginInfo(CommandBufferUsageFlagBits::eOneTimeSubmit));
+    if (queryPool)
+      cmdBuff.resetQueryPool(queryPool, 0, 2);
+    cmdBuff.bindPipeline(PipelineBindPoint::eCompute, this->pipe);
+    this->bindBuffers(cmdBuff, f.descSets.data(), f.addrs.data());
+    if (queryPool)
+      cmdBuff.writeTimestamp(PipelineStageFlagBits::eTopOfPipe, queryPool, 0);
+    cmdBuff.dispatch(groups[0], groups[1], groups[2]);
+    if (queryPool)
+      cmdBuff.writeTimestamp(PipelineStageFlagBits::eBottomOfPipe, queryPool,
+                             1);
+    cmdBuff.end();
+
+    Fence fence = this->fences.acquire();
+    auto start = chrono::steady_clock::now();
+    this->ctx->submits.submit(this->queue,
+                         SubmitInfo(0, nullptr, nullptr, 1, &cmdBuff), fence);
+    this->waitFenceRes = this->dev.waitForFences({fence}, true, uint64_t(-1));
+    uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(
+                      chrono::steady_clock::now() - start)
+                      .count();
+    this->fences.release(fence);
+    uint64_t stamps[2];
+    if (queryPool &&
+        this->dev.getQueryPoolResults(
+            queryPool, 0, 2, sizeof(stamps), stamps, sizeof(uint64_t),
+            QueryResultFlagBits::e64 | QueryResultFlagBits::eWait) ==
+            Result::eSuccess)
+      ns = uint64_t(((stamps[1] - stamps[0]) & mask) * period);
+    if (it)
+      best = min(best, ns);
+  }
+  return best;
+}
+// Create the descriptor cache, the pools and sets come from it
 void stdEng::createDescriptorPool() {
-  /* The second parameter is the number of descriptors per type. Since there is
-   * only one type here, this is the total number of bindings.
-   */
-  DescriptorPoolSize descPoolSize(DescriptorType::eStorageBuffer,
-                                  this->sumBind);
-  this->descPoolSize = descPoolSize;
-  DescriptorPoolCreateInfo descPoolInfo(DescriptorPoolCreateFlags(),
-                                        this->bindings.size(), descPoolSize);
-  this->descPoolInfo = descPoolInfo;
-  DescriptorPool descPool = this->dev.createDescriptorPool(descPoolInfo);
-  this->descPool = descPool;
+  // templates are core since Vulkan 1.1, for the instance and the device
+  bool useTemplates =
+      min(this->ctx->appInfo.apiVersion,
+          this->physdev.getProperties().apiVersion) >= VK_API_VERSION_1_1;
+  // every frame and its replacement after a defragment or an import
+  this->descs.init(this->dev, this->descSetLays, this->bindings,
+                   this->bufferSlots(), 2 * this->framesInFlight,
+                   useTemplates);
 }
 
-// DescriptorSet allocation for binding to the DescriptorSetLayout
+/* The set and binding of every buffer, the inputs then the outputs. Both go
+ * through the bindings of each set in order, the outputs start at
+ * IOSetOffset and IOBindingOffset when setBindings was given them. Buffers
+ * past the last binding get set ~0 and are not bound.
+ */
+vector<pair<uint32_t, uint32_t>> stdEng::bufferSlots() {
+  vector<pair<uint32_t, uint32_t>> slots;
+  uint32_t setI = 0, bindI = 0;
+  size_t count = this->insizes.size() + this->outsizes.size();
+  for (size_t p = 0; p < count; ++p) {
+    if (this->IOOffsets && p == this->insizes.size()) {
+      setI = this->IOSetOffset;
+      bindI = this->IOBindingOffset;
+    }
+    while (setI < this->bindings.size() && bindI >= this->bindings.at(setI)) {
+      ++setI;
+      bindI = 0;
+    }
+    if (setI >= this->bindings.size())
+      slots.push_back(make_pair(~0u, ~0u));
+    else
+      slots.push_back(make_pair(setI, bindI++));
+  }
+  return slots;
+}
+
+// DescriptorSet of every frame
 void stdEng::allocateDescriptorSet() {
-  DescriptorSetAllocateInfo descSetAllocInfo(
-      this->descPool, this->bindings.size(), &this->descSetLay);
-  this->descSetAllocInfo = descSetAllocInfo;
-  this->descSets = this->dev.allocateDescriptorSets(descSetAllocInfo);
+  for (frame &f : this->frames)
+    this->writeDescriptorSets(f);
+}
+
+/* point the descriptor sets of frame f to its input and output buffers, the
+ * sets of the cache are reused when the buffers did not change
+ */
+void stdEng::writeDescriptorSets(frame &f) {
+  // command buffers that bound the old sets can not be submitted again
+  f.recorded = false;
+  if (this->addressMode) {
+    f.addrs.clear();
+    for (Buffer buff : f.inBuffs)
+      f.addrs.push_back(this->bufferAddress(buff));
+    for (Buffer buff : f.outBuffs)
+      f.addrs.push_back(this->bufferAddress(buff));
+    return;
+  }
   vector<DescriptorBufferInfo> descBuffInfos;
   for (uint32_t i = 0; i < this->insizes.size(); ++i) {
-    DescriptorBufferInfo descbuffinfo(this->inBuffs.at(i), 0,
+    DescriptorBufferInfo descbuffinfo(f.inBuffs.at(i), 0,
                                       this->inBuffInfos.at(i).size);
     descBuffInfos.push_back(descbuffinfo);
   }
   for (uint32_t i = 0; i < this->outsizes.size(); ++i) {
-    DescriptorBufferInfo descbuffinfo(this->outBuffs.at(i), 0,
+    DescriptorBufferInfo descbuffinfo(f.outBuffs.at(i), 0,
                                       this->outBuffInfos.at(i).size);
     descBuffInfos.push_back(descbuffinfo);
   }
-  vector<WriteDescriptorSet> writeDescSets;
-  uint32_t p = 0;
-  if (IOBindingOffset != 0) {
-    for (uint32_t i = 0; i <= IOSetOffset; ++i) {
-      if (i != IOSetOffset) {
-        for (uint32_t j = 0; j < bindings.at(i); ++j) {
-          writeDescSets.push_back({descSets.at(i), j, 0, i,
-                                   DescriptorType::eStorageBuffer, nullptr,
-                                   &descBuffInfos.at(p)});
-          p++;
-        }
-      }
-    }
-  } else {
-    for (uint32_t i = 0; i < IOSetOffset; ++i) {
-      for (uint32_t j = 0; j < bindings.at(i); ++j) {
-        writeDescSets.push_back({descSets.at(i), j, 0, i,
-                                 DescriptorType::eStorageBuffer, nullptr,
-                                 &descBuffInfos.at(p)});
-        p++;
-      }
-    }
+  f.descSets = this->descs.get(descBuffInfos);
+}
+
+// the address of buff for the shader, in address mode
+DeviceAddress stdEng::bufferAddress(Buffer buff) {
+  if (this->addressCore)
+    return this->dev.getBufferAddress(BufferDeviceAddressInfo(buff));
+  return this->dev.getBufferAddressKHR(BufferDeviceAddressInfo(buff),
+                                       this->dld);
+}
+
+// the size of the addresses in front of the push constants
+uint32_t stdEng::addressBytes() {
+  if (!this->addressMode)
+    return 0;
+  return uint32_t((this->insizes.size() + this->outsizes.size()) *
+                  sizeof(DeviceAddress));
+}
+
+/* Give one dispatch its buffers and push constants, the descriptor sets of
+ * every set, or in address mode one push of the addresses and the push data
+ *
+ * @param descSets bindings.size() sets, unused in address mode
+ * @param addrs addressBytes() worth of addresses, unused otherwise
+ */
+void stdEng::bindBuffers(CommandBuffer cmdBuff, const DescriptorSet *descSets,
+                         const DeviceAddress *addrs) {
+  if (!this->addressMode) {
+    cmdBuff.bindDescriptorSets(
+        PipelineBindPoint::eCompute, this->pipeLay, 0,
+        ArrayProxy<const DescriptorSet>(uint32_t(this->bindings.size()),
+                                        descSets),
+        {});
+    if (!this->pushData.empty())
+      cmdBuff.pushConstants(this->pipeLay, ShaderStageFlagBits::eCompute, 0,
+                            uint32_t(this->pushData.size()),
+                            this->pushData.data());
+    return;
   }
-  this->dev.updateDescriptorSets(writeDescSets, nullptr);
+  uint32_t addrBytes = this->addressBytes();
+  vector<char> block(addrBytes + this->pushData.size());
+  memcpy(block.data(), addrs, addrBytes);
+  if (!this->pushData.empty())
+    memcpy(block.data() + addrBytes, this->pushData.data(),
+           this->pushData.size());
+  cmdBuff.pushConstants(this->pipeLay, ShaderStageFlagBits::eCompute, 0,
+                        uint32_t(block.size()), block.data());
 }
 
-// Commamd Buffer Creation for sending the command
+/* Commamd Buffer Creation for sending the command
+ *
+ * Each frame has its own pools, so resetting one while the others are still
+ * in flight is fine.
+ */
 void stdEng::createCommandBuffer() {
   CommandPoolCreateInfo cmdPoolInfo(CommandPoolCreateFlags(),
                                     this->queueFamIndex);
   this->cmdPoolInfo = cmdPoolInfo;
-  CommandPool cmdPool = this->dev.createCommandPool(cmdPoolInfo);
-  this->cmdPool = cmdPool;
-  CommandBufferAllocateInfo cmdBuffAllocInfo(cmdPool,
-                                             CommandBufferLevel::ePrimary, 1);
-  this->cmdBuffAllocInfo = cmdBuffAllocInfo;
-  vector<CommandBuffer> cmdBuffs =
-      this->dev.allocateCommandBuffers(cmdBuffAllocInfo);
-  for (CommandBuffer cmdbuff : cmdBuffs)
-    this->cmdBuffs.push_back(cmdbuff);
-}
-
-// Send Command with CommandBuffer to the GPU
-void stdEng::sendCommand() {
+  for (frame &f : this->frames) {
+    f.cmdPool = this->dev.createCommandPool(cmdPoolInfo);
+    CommandBufferAllocateInfo cmdBuffAllocInfo(
+        f.cmdPool, CommandBufferLevel::ePrimary, 1);
+    this->cmdBuffAllocInfo = cmdBuffAllocInfo;
+    f.cmdBuffs = this->dev.allocateCommandBuffers(cmdBuffAllocInfo);
+
+    // upload and download command buffers for the transfer queue
+    if (this->dedicatedTransfer()) {
+      f.transferCmdPool = this->dev.createCommandPool(CommandPoolCreateInfo(
+          CommandPoolCreateFlags(), this->transferFamIndex));
+      f.transferCmdBuffs = this->dev.allocateCommandBuffers(
+          CommandBufferAllocateInfo(f.transferCmdPool,
+                                    CommandBufferLevel::ePrimary, 2));
+      f.uploadSem = this->dev.createSemaphore(SemaphoreCreateInfo());
+      f.computeSem = this->dev.createSemaphore(SemaphoreCreateInfo());
+    }
+  }
+
+  // six timestamps per frame: upload, barrier, dispatch, barrier, download
+  uint32_t validBits =
+      this->physdev.getQueueFamilyProperties()[this->queueFamIndex]
+          .timestampValidBits;
+  if (!this->profiling || !validBits)
+    return;
+  this->stampPeriod = this->physdev.getProperties().limits.timestampPeriod;
+  this->stampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+  for (frame &f : this->frames)
+    f.queryPool = this->dev.createQueryPool(
+        QueryPoolCreateInfo(QueryPoolCreateFlags(), QueryType::eTimestamp, 6));
+}
+
+// copy the staged inputs of frame f to its device local input buffers
+void stdEng::recordUpload(frame &f, CommandBuffer cmdBuff) {
+  for (size_t i = 0; i < f.inBuffs.size(); ++i)
+    if (!f.inImported.at(i))
+      cmdBuff.copyBuffer(
+          this->staging.buffer(), f.inBuffs.at(i),
+          BufferCopy(f.inStageOffsets.at(i), 0, this->insizes.at(i)));
+}
+
+// copy the device local outputs of frame f back to the staging ring
+void stdEng::recordDownload(frame &f, CommandBuffer cmdBuff) {
+  for (size_t i = 0; i < f.outBuffs.size(); ++i)
+    cmdBuff.copyBuffer(
+        f.outBuffs.at(i), this->staging.buffer(),
+        BufferCopy(0, f.outStageOffsets.at(i), this->outsizes.at(i)));
+  cmdBuff.pipelineBarrier(
+      PipelineStageFlagBits::eTransfer, PipelineStageFlagBits::eHost, {},
+      MemoryBarrier(AccessFlagBits::eTransferWrite, AccessFlagBits::eHostRead),
+      nullptr, nullptr);
+}
+
+/* Record the commands of frame f, sent to the GPU by submitFrame. With
+ * command reuse the buffers of the last submission of f are kept when they
+ * were recorded for the same shape.
+ */
+void stdEng::sendCommand(frame &f) {
+  uint32_t groups[3];
+  this->groupCount(groups);
+  if (f.recorded && f.recPipe == this->pipe &&
+      equal(groups, groups + 3, f.recGroups) && f.recPush == this->pushData) {
+    ++this->recStats.reuses;
+    return;
+  }
+  auto start = chrono::steady_clock::now();
   CommandBufferBeginInfo cmdBuffBeginInfo(
-      CommandBufferUsageFlagBits::eOneTimeSubmit);
+      this->reuseCommands ? CommandBufferUsageFlags()
+                          : CommandBufferUsageFlags(
+                                CommandBufferUsageFlagBits::eOneTimeSubmit));
   this->cmdBuffBeginInfo = cmdBuffBeginInfo;
-  CommandBuffer cmdBuff = this->cmdBuffs.front();
+  CommandBuffer cmdBuff = f.cmdBuffs.front();
 
+  // the pool has no eResetCommandBuffer flag, so reset it as a whole before
+  // recording again
+  this->dev.resetCommandPool(f.cmdPool);
   cmdBuff.begin(cmdBuffBeginInfo);
+  // without a transfer queue the copies are recorded around the dispatch
+  bool inlineCopies = this->deviceLocal && !this->dedicatedTransfer();
+  auto stamp = [&](uint32_t query) {
+    if (f.queryPool && (inlineCopies || query == 2 || query == 3))
+      cmdBuff.writeTimestamp(query ? PipelineStageFlagBits::eBottomOfPipe
+                                   : PipelineStageFlagBits::eTopOfPipe,
+                             f.queryPool, query);
+  };
+  if (f.queryPool)
+    cmdBuff.resetQueryPool(f.queryPool, 0, 6);
+  if (inlineCopies) {
+    stamp(0);
+    this->recordUpload(f, cmdBuff);
+    stamp(1);
+    cmdBuff.pipelineBarrier(PipelineStageFlagBits::eTransfer,
+                            PipelineStageFlagBits::eComputeShader, {},
+                            MemoryBarrier(AccessFlagBits::eTransferWrite,
+                                          AccessFlagBits::eShaderRead),
+                            nullptr, nullptr);
+  }
+  stamp(2);
   cmdBuff.bindPipeline(PipelineBindPoint::eCompute, this->pipe);
-  cmdBuff.bindDescriptorSets(PipelineBindPoint::eCompute, this->pipeLay, 0,
-                             this->descSets, {});
-  cmdBuff.dispatch(this->width, this->height, this->depth);
+  // the push constants at submit time, nothing else changes when they do
+  this->bindBuffers(cmdBuff, f.descSets.data(), f.addrs.data());
+  cmdBuff.dispatch(groups[0], groups[1], groups[2]);
+  stamp(3);
+  if (inlineCopies) {
+    cmdBuff.pipelineBarrier(PipelineStageFlagBits::eComputeShader,
+                            PipelineStageFlagBits::eTransfer, {},
+                            MemoryBarrier(AccessFlagBits::eShaderWrite,
+                                          AccessFlagBits::eTransferRead),
+                            nullptr, nullptr);
+    stamp(4);
+    this->recordDownload(f, cmdBuff);
+    stamp(5);
+  }
   cmdBuff.end();
+
+  if (this->dedicatedTransfer()) {
+    this->dev.resetCommandPool(f.transferCmdPool);
+    CommandBuffer upload = f.transferCmdBuffs.at(0);
+    upload.begin(cmdBuffBeginInfo);
+    this->recordUpload(f, upload);
+    upload.end();
+    CommandBuffer download = f.transferCmdBuffs.at(1);
+    download.begin(cmdBuffBeginInfo);
+    this->recordDownload(f, download);
+    download.end();
+  }
+
+  f.recorded = this->reuseCommands;
+  f.recPipe = this->pipe;
+  copy(groups, groups + 3, f.recGroups);
+  f.recPush = this->pushData;
+  ++this->recStats.recordings;
+  this->recStats.nanoseconds += chrono::duration_cast<chrono::nanoseconds>(
+                                    chrono::steady_clock::now() - start)
+                                    .count();
 }
 
-// wait gpu proccess with Fence to mark if finish or not
-void stdEng::waitFence() {
-  this->queue = this->dev.getQueue(this->queueFamIndex, 0);
-  this->fence = this->dev.createFence(FenceCreateInfo());
-  SubmitInfo submitInfo(0, nullptr, nullptr, 1, this->cmdBuffs.data());
+/* Get the queues and create one fence per frame in flight, they are recycled
+ * by every submission so there is nothing left to create on the hot path
+ */
+void stdEng::createFence() {
+  this->queues.clear();
+  for (uint32_t i = 0; i < this->queueCount; ++i)
+    this->queues.push_back(this->dev.getQueue(this->queueFamIndex, i));
+  this->transferQueues.clear();
+  for (uint32_t i = 0; i < this->transferQueueCount; ++i)
+    this->transferQueues.push_back(
+        this->dev.getQueue(this->transferFamIndex, i));
+  this->queue = this->queues.front();
+  this->transferQueue = this->transferQueues.front();
+  this->fences.init(this->dev, this->framesInFlight);
+}
+
+/* The compute queue with the fewest frames still running on it, ties go round
+ * robin. Frames do not share buffers, so they need no sync between queues.
+ */
+uint32_t stdEng::pickQueue() {
+  vector<uint32_t> load(this->queues.size(), 0);
+  for (uint32_t i = 0; i < this->frames.size(); ++i)
+    if (!this->pollFrame(i))
+      ++load.at(this->frames.at(i).queueI);
+  uint32_t best = this->nextQueue % this->queues.size();
+  for (uint32_t n = 1; n < this->queues.size(); ++n) {
+    uint32_t q = (this->nextQueue + n) % this->queues.size();
+    if (load.at(q) < load.at(best))
+      best = q;
+  }
+  this->nextQueue = best + 1;
+  return best;
+}
+
+// submit frame f with a fence from the pool, without waiting for it
+void stdEng::submitFrame(frame &f) {
+  f.queueI = this->pickQueue();
+  Queue queue = this->queues.at(f.queueI);
+  // the copies of a frame stay on the transfer queue paired with its queue
+  Queue transferQueue =
+      this->transferQueues.at(f.queueI % this->transferQueues.size());
+  f.fence = this->fences.acquire();
+  f.stamped = bool(f.queryPool);
+  SubmitInfo submitInfo(0, nullptr, nullptr, 1, f.cmdBuffs.data());
+  if (this->dedicatedTransfer()) {
+    // upload -> compute -> download, chained with semaphores across queues
+    PipelineStageFlags computeStage = PipelineStageFlagBits::eComputeShader;
+    PipelineStageFlags transferStage = PipelineStageFlagBits::eTransfer;
+    this->ctx->submits.submit(transferQueue,
+                         SubmitInfo(0, nullptr, nullptr, 1,
+                                    &f.transferCmdBuffs.at(0), 1,
+                                    &f.uploadSem));
+    submitInfo = SubmitInfo(1, &f.uploadSem, &computeStage, 1,
+                            f.cmdBuffs.data(), 1, &f.computeSem);
+    this->ctx->submits.submit(queue, submitInfo);
+    this->ctx->submits.submit(transferQueue,
+                         SubmitInfo(1, &f.computeSem, &transferStage, 1,
+                                    &f.transferCmdBuffs.at(1)),
+                         f.fence);
+  } else {
+    this->ctx->submits.submit(queue, submitInfo, f.fence);
+  }
   this->submitInfo = submitInfo;
-  queue.submit({submitInfo}, fence);
-  Result waitFenceRes = this->dev.waitForFences({fence}, true, this->time);
-  this->waitFenceRes = waitFenceRes;
+}
+
+// true when the last submission of the frame is done, without blocking
+bool stdEng::pollFrame(uint32_t frameI) {
+  frame &f = this->frames.at(frameI);
+  if (!f.fence)
+    return true;
+  if (this->dev.getFenceStatus(f.fence) != Result::eSuccess)
+    return false;
+  this->fences.release(f.fence);
+  f.fence = Fence();
+  this->collectProfile(f);
+  return true;
+}
+
+/* wait gpu proccess with Fence to mark if finish or not, the fence goes back
+ * to the pool once it is signaled
+ */
+Result stdEng::waitFrame(uint32_t frameI, uint64_t timeout) {
+  frame &f = this->frames.at(frameI);
+  if (!f.fence)
+    return Result::eSuccess;
+  auto start = chrono::steady_clock::now();
+  Result res = this->dev.waitForFences({f.fence}, true, timeout);
+  if (tracer::enabled()) {
+    tracer::span("vkWaitForFences", start, chrono::steady_clock::now());
+    tracer::instant("vkWaitForFences result", int64_t(res));
+  }
+  if (this->profiling)
+    this->profile.waitNanoseconds +=
+        chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start)
+            .count();
+  if (res == Result::eSuccess) {
+    this->fences.release(f.fence);
+    f.fence = Fence();
+    this->collectProfile(f);
+  }
+  return res;
+}
+
+/* Add the gpu times of the last submission of f, which is done, so its
+ * timestamps are read without waiting
+ */
+void stdEng::collectProfile(frame &f) {
+  if (!f.stamped)
+    return;
+  f.stamped = false;
+  bool inlineCopies = this->deviceLocal && !this->dedicatedTransfer();
+  uint32_t first = inlineCopies ? 0 : 2, count = inlineCopies ? 6 : 2;
+  uint64_t stamps[6] = {0, 0, 0, 0, 0, 0};
+  if (this->dev.getQueryPoolResults(f.queryPool, first, count,
+                                    count * sizeof(uint64_t), stamps + first,
+                                    sizeof(uint64_t),
+                                    QueryResultFlagBits::e64) !=
+      Result::eSuccess)
+    return;
+  auto span = [&](uint32_t from, uint32_t to) {
+    return uint64_t(((stamps[to] - stamps[from]) & this->stampMask) *
+                    this->stampPeriod);
+  };
+  ++this->profile.timedSubmissions;
+  this->profile.lastDispatchNanoseconds = span(2, 3);
+  this->profile.dispatchNanoseconds += span(2, 3);
+  if (inlineCopies) {
+    this->profile.uploadNanoseconds += span(0, 1);
+    this->profile.barrierNanoseconds += span(1, 2) + span(3, 4);
+    this->profile.downloadNanoseconds += span(4, 5);
+  }
+}
+
+// wait for every frame in flight
+void stdEng::waitIdle() {
+  for (uint32_t i = 0; i < this->frames.size(); ++i)
+    this->waitFrame(i, uint64_t(-1));
+}
+
+// true when the submission belongs to an engine
+bool submission::valid() const { return this->eng != nullptr; }
+
+/* true when the gpu is done with the submission. A frame that was submitted
+ * again since then was waited on before, so it is done too.
+ */
+bool submission::ready() const {
+  if (!this->eng)
+    return false;
+  if (this->eng->frames.at(this->frame).serial != this->serial)
+    return true;
+  return this->eng->pollFrame(this->frame);
+}
+
+/* Block until the gpu is done with the submission
+ *
+ * @param timeout In nanoseconds, eTimeout is returned when it passed first
+ */
+Result submission::wait(uint64_t timeout) const {
+  if (!this->eng)
+    return Result::eErrorInitializationFailed;
+  if (this->eng->frames.at(this->frame).serial != this->serial)
+    return Result::eSuccess;
+  return this->eng->waitFrame(this->frame, timeout);
+}
+
+// host time of one step of build(), start is moved to now for the next
+void stdEng::endPhase(const char *name,
+                      chrono::steady_clock::time_point &start) {
+  auto now = chrono::steady_clock::now();
+  tracer::span(name, start, now);
+  this->profile.buildPhases.push_back(
+      {name, uint64_t(chrono::duration_cast<chrono::nanoseconds>(now - start)
+                          .count())});
+  start = now;
 }
 
 // metode public
-// the main method to running all previous methods in order
-void stdEng::run() {
+/* Build everything that does not depend on the input data: device, buffers,
+ * memory, shader, layouts, pipeline, descriptors, command buffer and fence.
+ * Call it once, then call dispatch() as many times as you want.
+ *
+ * The sizes passed to setInputs and setOutputs are fixed from here on, only
+ * the data may change between dispatches.
+ */
+void stdEng::build() {
+  traceScope scope("build");
+  if (this->built) {
+    cout << "Engine already built!" << endl;
+    return;
+  }
   if (this->debugMode == DebugMode::VERBOSE) {
+    const ApplicationInfo &appInfo = this->ctx->appInfo;
+    const InstanceCreateInfo &instInfo = this->ctx->instInfo;
     cout << "Instance was created with :" << endl;
     ;
     cout << "\tApplicationInfo" << endl;
-    cout << "\t\tApplication Name = " << this->appInfo.pApplicationName << ","
+    cout << "\t\tApplication Name = " << appInfo.pApplicationName << ","
          << endl;
-    cout << "\t\tApplication Version = " << this->appInfo.applicationVersion
+    cout << "\t\tApplication Version = " << appInfo.applicationVersion
          << "," << endl;
-    cout << "\t\tEngine Name = " << this->appInfo.pEngineName << "," << endl;
-    cout << "\t\tEngine Version = " << this->appInfo.engineVersion << ","
+    cout << "\t\tEngine Name = " << appInfo.pEngineName << "," << endl;
+    cout << "\t\tEngine Version = " << appInfo.engineVersion << ","
          << endl;
-    cout << "\t\tApi Version used = " << this->appInfo.apiVersion << ","
+    cout << "\t\tApi Version used = " << appInfo.apiVersion << ","
          << endl;
     cout << "\tInstanceCreateInfo" << endl;
-    cout << "\t\tInstance Flags = " << to_string(this->instInfo.flags) << ","
+    cout << "\t\tInstance Flags = " << to_string(instInfo.flags) << ","
          << endl;
-    cout << "\t\tAmount of active layer = " << this->instInfo.enabledLayerCount
+    cout << "\t\tAmount of active layer = " << instInfo.enabledLayerCount
          << "," << endl;
     cout << "\t\tActive layers" << endl;
-    for (uint32_t i = 0; i < this->instInfo.enabledLayerCount; ++i)
-      cout << "\t\t\t" << this->instInfo.ppEnabledLayerNames[i] << endl;
+    for (uint32_t i = 0; i < instInfo.enabledLayerCount; ++i)
+      cout << "\t\t\t" << instInfo.ppEnabledLayerNames[i] << endl;
     cout << "\t\tAmount of active extensions"
-         << this->instInfo.enabledExtensionCount << endl;
-    if (this->instInfo.enabledExtensionCount)
+         << instInfo.enabledExtensionCount << endl;
+    if (instInfo.enabledExtensionCount)
       cout << "\t\tActive extensions" << endl;
-    for (uint32_t i = 0; i < this->instInfo.enabledExtensionCount; ++i)
-      cout << "\t\t\t" << this->instInfo.ppEnabledExtensionNames[i] << ","
+    for (uint32_t i = 0; i < instInfo.enabledExtensionCount; ++i)
+      cout << "\t\t\t" << instInfo.ppEnabledExtensionNames[i] << ","
            << endl;
     cout << endl;
     cout << "start creating logical device" << endl;
   }
 
+  // the steps are timed even without profiling, it is one clock read each
+  auto phaseStart = chrono::steady_clock::now();
   this->createDevice();
+  this->endPhase("createDevice", phaseStart);
 
   if (!(this->debugMode == DebugMode::NO)) {
     cout << "logical device created" << endl;
@@ -485,6 +1724,7 @@ void stdEng::run() {
   }
 
   this->createBuffer();
+  this->endPhase("createBuffer", phaseStart);
 
   if (!(this->debugMode == DebugMode::NO)) {
     cout << "Buffers created!" << endl;
@@ -510,6 +1750,7 @@ void stdEng::run() {
   }
 
   this->allocateMemory();
+  this->endPhase("allocateMemory", phaseStart);
 
   if (!(this->debugMode == DebugMode::NO)) {
     cout << "Memory allocated!" << endl;
@@ -531,36 +1772,24 @@ void stdEng::run() {
            << this->physdev.getMemoryProperties().memoryTypeCount << endl;
       cout << "\t\tMemory Heap Count = "
            << this->physdev.getMemoryProperties().memoryHeapCount << endl;
-    }
-    cout << "Start filling inputs" << endl;
-  }
-
-  this->fillInputs();
-
-  if (!(this->debugMode == DebugMode::NO)) {
-    cout << "Filling Inputs memories successfully!" << endl;
-    if (this->debugMode == DebugMode::VERBOSE) {
-      if (this->inMems.size() != this->inputs.size()) {
-        cout << "\tWarning! inputs and input memories vector has differ size"
-             << endl;
-        cout << "\tThis mean you were wrongly passing inputs size" << endl;
-      }
-      size_t minSize =
-          inMems.size() > inputs.size() ? inMems.size() : inputs.size();
-      for (size_t i = 0; i < minSize; ++i) {
-        cout << "\tinput memory " << i << "filled by" << endl;
-        cout << "\tinput " << i << "in byte:" << endl;
-        const char *inputBytes = reinterpret_cast<char *>(&inputs.at(i));
-        for (size_t j = 0; j < this->insizes.at(i) / this->inputs.at(i).size();
-             ++j)
-          cout << "\t\t" << static_cast<int>(inputBytes[j]);
-        cout << endl;
-      }
+      memArenaStats memStats = this->arena.getStats();
+      cout << "\tPlacement = "
+           << (this->deviceLocal ? "device local + staging" : "host visible")
+           << endl;
+      cout << "\tMemory Arena" << endl;
+      cout << "\t\tInput Memory Type Index = " << this->memTypeIndex << endl;
+      cout << "\t\tOutput Memory Type Index = " << this->outMemTypeIndex
+           << (this->outCoherent ? "" : " (non coherent)") << endl;
+      cout << "\t\tBlock Count = " << memStats.blockCount << endl;
+      cout << "\t\tReserved = " << memStats.reserved << endl;
+      cout << "\t\tUsed = " << memStats.used << endl;
     }
     cout << "Start load Shader!" << endl;
   }
 
   this->loadShader();
+  this->applyTuning();
+  this->endPhase("loadShader", phaseStart);
 
   if (!(this->debugMode == DebugMode::NO)) {
     cout << "Shader loaded!" << endl;
@@ -573,7 +1802,10 @@ void stdEng::run() {
     cout << "Start creating Descriptor Set Layout!" << endl;
   }
 
-  this->createDescriptorSetLayout();
+  // address mode has no descriptors at all
+  if (!this->addressMode)
+    this->createDescriptorSetLayout();
+  this->endPhase("createDescriptorSetLayout", phaseStart);
 
   if (!(this->debugMode == DebugMode::NO)) {
     cout << "Descriptor Set Layout created!" << endl;
@@ -592,15 +1824,14 @@ void stdEng::run() {
         cout << "\t\tSamplers=null" << endl; // we dont need
       }
       cout << "\tTotal Binding = " << this->sumBind << endl;
-      cout << "\tDescriptor Set Layout Create Info" << endl;
-      cout << "\t\tBinding count = " << this->descSetLayInfo.bindingCount
+      cout << "\tDescriptor Set Layouts = " << this->descSetLays.size()
            << endl;
-      cout << "\t\tFlags = " << to_string(this->descSetLayInfo.flags) << endl;
     }
     cout << "Start creating Pipeline Layout!" << endl;
   }
 
   this->createPipelineLayout();
+  this->endPhase("createPipelineLayout", phaseStart);
 
   if (!(this->debugMode == DebugMode::NO)) {
     cout << "Pipeline Layout created!" << endl;
@@ -616,9 +1847,12 @@ void stdEng::run() {
   }
 
   this->createPipeline();
+  this->endPhase("createPipeline", phaseStart);
 
   if (!(this->debugMode == DebugMode::NO)) {
-    cout << "Pipeline created!" << endl;
+    cout << "Pipeline created in " << this->pipeCompileTime / 1000 << " us ("
+         << (this->pipeCache.isWarm() ? "warm" : "cold") << " cache)"
+         << endl;
     if (this->debugMode == DebugMode::VERBOSE) {
       cout << "\tFlags = " << to_string(this->compPipeInfo.flags) << endl;
       cout << "\tCompute Pipeline Shader Stage Create Info:" << endl;
@@ -626,7 +1860,8 @@ void stdEng::run() {
            << endl;
       cout << "\t\tStage = " << to_string(this->compPipeInfo.stage.stage)
            << endl;
-      cout << "\t\tShader module from = " << this->filepath << endl;
+      cout << "\t\tShader module from = "
+           << (this->shadCode ? "memory" : this->filepath) << endl;
       // specializationInfo we dont need this i think
       cout << "\t\tPipeline Layout = " << this->pipeLay << endl;
       cout << "\t\tBase Pipeline Handle = " << this->compPipeInfo.basePipelineHandle << endl;
@@ -635,41 +1870,27 @@ void stdEng::run() {
     cout << "Start creating Descriptor Pool" << endl;
   }
 
-  this->createDescriptorPool();
+  if (!this->addressMode)
+    this->createDescriptorPool();
+  this->endPhase("createDescriptorPool", phaseStart);
 
   if (!(this->debugMode == DebugMode::NO)) {
-    cout << "Descriptor Pool created!" << endl;
-    if (this->debugMode == DebugMode::VERBOSE) {
-      cout << "\tFlags = " << to_string(this->descPoolInfo.flags) << endl;
-      cout << "\tPool Size Count = " << this->descPoolInfo.poolSizeCount
-           << endl;
-      if (this->descPoolInfo.poolSizeCount)
-        cout << "\tPoolsizes" << endl;
-      for (uint32_t i = 0; i < this->descPoolInfo.poolSizeCount; ++i) {
-        cout << "\t\tPool size" << i << endl;
-        cout << "\t\t\tType = "
-             << to_string(this->descPoolInfo.pPoolSizes[i].type) << endl;
-        cout << "\t\t\tCount = "
-             << this->descPoolInfo.pPoolSizes[i].descriptorCount << endl;
-      }
-    }
+    cout << "Descriptor cache created!" << endl;
   }
   this->allocateDescriptorSet();
+  this->endPhase("allocateDescriptorSet", phaseStart);
 
   if (!(this->debugMode == DebugMode::NO)) {
     cout << "Descriptor Set allocated!" << endl;
-    if (this->debugMode == DebugMode::VERBOSE) {
-      cout << "\tDescriptor Set Allocate Info" << endl;
-      cout << "\t\tDescriptor Pool = " << this->descSetAllocInfo.descriptorPool
-           << endl;
-      cout << "\t\tDescriptor Set Count = "
-           << this->descSetAllocInfo.descriptorSetCount << endl;
-      cout << "\t\tDescriptor Set Layouts" << endl;
-      for (uint32_t i = 0; i < this->descSetAllocInfo.descriptorSetCount; ++i)
-        cout << "\t\t\t" << this->descSetAllocInfo.pSetLayouts[i] << endl;
-    }
+    if (this->debugMode == DebugMode::VERBOSE)
+      for (frame &f : this->frames) {
+        cout << "\tDescriptor Sets of a frame" << endl;
+        for (DescriptorSet descSet : f.descSets)
+          cout << "\t\t" << descSet << endl;
+      }
   }
   this->createCommandBuffer();
+  this->endPhase("createCommandBuffer", phaseStart);
 
   if (!(this->debugMode == DebugMode::NO)) {
     cout << "Command Buffer created!" << endl;
@@ -687,96 +1908,720 @@ void stdEng::run() {
            << this->cmdBuffAllocInfo.commandBufferCount << endl;
     }
   }
-  this->sendCommand();
+  this->createFence();
+  this->endPhase("createFence", phaseStart);
+  this->built = true;
+  this->pipeCache.save();
 
-  if (!(this->debugMode == DebugMode::NO)) {
-    cout << "Command sent!" << endl;
-    if (this->debugMode == DebugMode::VERBOSE) {
-      cout << "\tCommand Buffer Begin Info" << endl;
-      cout << "\t\tCommand Buffer Usage = "
-           << to_string(this->cmdBuffAllocInfo.level) << endl;
-      cout << "\t\tCommand Buffer Count = "
-           << this->cmdBuffAllocInfo.commandBufferCount << endl;
+  if (!(this->debugMode == DebugMode::NO))
+    cout << "Engine built!" << endl;
+}
+
+/* Upload the current inputs, record the dispatch and submit it without
+ * waiting. Everything else was created by build(), so this is the only part
+ * that costs something per call.
+ *
+ * Only waits when the frame it uses is still in flight, framesInFlight
+ * submissions ago.
+ *
+ * @return the handle to wait on before reading the outputs
+ */
+submission stdEng::submit() {
+  traceScope scope("submit");
+  frame &f = this->acquireFrame();
+
+  auto start = chrono::steady_clock::now();
+  this->fillInputs(f);
+  // the specialization constants may have changed since the last submit
+  this->pipe = this->pipelineVariant();
+  auto filled = chrono::steady_clock::now();
+  this->sendCommand(f);
+  auto recorded = chrono::steady_clock::now();
+  this->submitFrame(f);
+  auto submitted = chrono::steady_clock::now();
+
+  if (this->profiling) {
+    ++this->profile.submissions;
+    this->profile.fillNanoseconds +=
+        chrono::duration_cast<chrono::nanoseconds>(filled - start).count();
+    this->profile.recordNanoseconds +=
+        chrono::duration_cast<chrono::nanoseconds>(recorded - filled).count();
+    this->profile.submitNanoseconds +=
+        chrono::duration_cast<chrono::nanoseconds>(submitted - recorded)
+            .count();
+  }
+  if (tracer::enabled()) {
+    tracer::span("fillInputs", start, filled);
+    tracer::span("sendCommand", filled, recorded);
+    tracer::span("submitFrame", recorded, submitted);
+    tracer::instant("frame", this->curFrame);
+  }
+
+  submission s;
+  s.eng = this;
+  s.frame = this->curFrame;
+  s.serial = this->nextSerial++;
+  f.serial = s.serial;
+  this->lastFrame = this->curFrame;
+  this->curFrame = (this->curFrame + 1) % this->framesInFlight;
+  return s;
+}
+
+// submit and wait for it, the blocking form of submit()
+void stdEng::dispatch() {
+  traceScope scope("dispatch");
+  submission s = this->submit();
+  this->waitFenceRes = s.wait(this->time);
+}
+
+// the main method, build on the first call and dispatch on every call
+void stdEng::run() {
+  if (!this->built)
+    this->build();
+  this->dispatch();
+}
+
+/* Stream a dataset of any size through input 0 and output 0
+ *
+ * The stream is cut in chunks of the size of input 0 given with setInputs,
+ * every chunk is one submission. With 2 or 3 frames in flight the upload of
+ * chunk N+1, the kernel on chunk N and the readback of chunk N-1 overlap, the
+ * copies run on their own queue when the device has one. The other inputs
+ * keep the data given with setInputs.
+ *
+ * @param read Fills the chunk and returns the bytes written, less than size
+ * only for the last chunk and 0 at the end. The rest of a short chunk is
+ * zeroed.
+ * @param write Receives output 0 of every chunk in order, the pointer is only
+ * valid during the call.
+ */
+streamStats stdEng::stream(
+    function<size_t(void *chunk, size_t size)> read,
+    function<void(const void *chunk, size_t size)> write) {
+  if (!this->built)
+    this->build();
+  streamStats stats;
+  size_t inChunk = this->insizes.at(0), outChunk = this->outsizes.at(0);
+  vector<submission> inFlight(this->framesInFlight);
+  bool streaming = this->streaming;
+  this->streaming = true;
+  auto start = chrono::steady_clock::now();
+  for (uint64_t chunk = 0;; ++chunk) {
+    /* the oldest submission uses the frame filled next, its outputs are
+     * read back before the frame is reused
+     */
+    submission &oldest = inFlight.at(chunk % this->framesInFlight);
+    if (oldest.valid()) {
+      write(this->outputData(oldest.frame, oldest.serial, 0), outChunk);
+      stats.bytesOut += outChunk;
+      oldest = submission();
     }
+    char *in = static_cast<char *>(this->inputData(0));
+    size_t filled = read(in, inChunk);
+    if (!filled)
+      break;
+    if (filled < inChunk)
+      memset(in + filled, 0, inChunk - filled);
+    stats.bytesIn += filled;
+    ++stats.chunks;
+    oldest = this->submit();
   }
-  this->waitFence();
+  // the chunks still in flight, oldest first
+  for (uint32_t i = 0; i < this->framesInFlight; ++i) {
+    submission &s = inFlight.at((stats.chunks + i) % this->framesInFlight);
+    if (!s.valid())
+      continue;
+    write(this->outputData(s.frame, s.serial, 0), outChunk);
+    stats.bytesOut += outChunk;
+  }
+  this->streaming = streaming;
+  stats.nanoseconds = chrono::duration_cast<chrono::nanoseconds>(
+                          chrono::steady_clock::now() - start)
+                          .count();
+  if (stats.nanoseconds)
+    stats.gbPerSec = double(stats.bytesIn + stats.bytesOut) / stats.nanoseconds;
+  return stats;
+}
 
-  if (!(this->debugMode == DebugMode::NO)) {
-    cout << "Fence waited!" << endl;
-    if (this->debugMode == DebugMode::VERBOSE) {
-      cout << "\tFence waited for = " << this->time << endl;
-      cout << "\tFence result = " << to_string(this->waitFenceRes) << endl;
+/* Same as above over memory of the caller
+ *
+ * @param src The whole input stream
+ * @param srcSize Its size in byte
+ * @param dst Output 0 of the chunks one after another, cut at dstSize
+ * @param dstSize The size of dst in byte
+ */
+streamStats stdEng::stream(const void *src, size_t srcSize, void *dst,
+                           size_t dstSize) {
+  size_t readPos = 0, writePos = 0;
+  return this->stream(
+      [&](void *chunk, size_t size) {
+        size_t n = min(size, srcSize - readPos);
+        memcpy(chunk, static_cast<const char *>(src) + readPos, n);
+        readPos += n;
+        return n;
+      },
+      [&](const void *chunk, size_t size) {
+        size_t n = min(size, dstSize - writePos);
+        memcpy(static_cast<char *>(dst) + writePos, chunk, n);
+        writePos += n;
+      });
+}
+
+static DeviceSize alignUp(DeviceSize value, DeviceSize alignment) {
+  return alignment > 1 ? (value + alignment - 1) / alignment * alignment
+                       : value;
+}
+
+/* Buffers, descriptor sets and command buffer of runBatch for the given
+ * number of jobs. Each input and output is one buffer holding the slot of
+ * every job, the descriptor sets of job j point at slot j.
+ *
+ * Batch buffers are always host visible, the jobs are small and a staging
+ * copy would cost more than the kernel.
+ */
+void stdEng::createBatch(batchRes &b, uint32_t jobs) {
+  this->destroyBatch(b);
+  PhysicalDeviceLimits limits = this->physdev.getProperties().limits;
+  DeviceSize align = max(limits.minStorageBufferOffsetAlignment, DeviceSize(1));
+  auto create = [&](const vector<BufferCreateInfo> &infos, bool output,
+                    vector<Buffer> &buffs, vector<memAlloc> &allocs,
+                    vector<DeviceSize> &strides) {
+    for (BufferCreateInfo buffInfo : infos) {
+      DeviceSize stride = alignUp(buffInfo.size, align);
+      buffInfo.size = stride * jobs;
+      Buffer buff = this->dev.createBuffer(buffInfo);
+      MemoryRequirements memReq = this->dev.getBufferMemoryRequirements(buff);
+      uint32_t typeIndex = uint32_t(~0);
+      if (output)
+        typeIndex = this->arena.findMemoryType(
+            memReq.memoryTypeBits, MemoryPropertyFlagBits::eHostVisible |
+                                       MemoryPropertyFlagBits::eHostCached,
+            MemoryPropertyFlagBits::eHostCoherent);
+      if (typeIndex == uint32_t(~0))
+        typeIndex = this->arena.findMemoryType(
+            memReq.memoryTypeBits, MemoryPropertyFlagBits::eHostVisible |
+                                       MemoryPropertyFlagBits::eHostCoherent);
+      if (typeIndex == uint32_t(~0)) {
+        cout << "No host visible heap found for the batch" << endl;
+        delete this;
+        exit(EXIT_FAILURE);
+      }
+      if (output)
+        b.outCoherent = bool(this->physdev.getMemoryProperties()
+                                 .memoryTypes[typeIndex]
+                                 .propertyFlags &
+                             MemoryPropertyFlagBits::eHostCoherent);
+      if (output && !b.outCoherent) {
+        memReq.alignment = max(memReq.alignment, this->atomSize);
+        memReq.size = alignUp(memReq.size, this->atomSize);
+      }
+      memAlloc alloc = this->arena.allocate(memReq, typeIndex);
+      this->dev.bindBufferMemory(buff, alloc.mem, alloc.offset);
+      buffs.push_back(buff);
+      allocs.push_back(alloc);
+      strides.push_back(stride);
     }
+  };
+  create(this->inBuffInfos, false, b.inBuffs, b.inAllocs, b.inStrides);
+  create(this->outBuffInfos, true, b.outBuffs, b.outAllocs, b.outStrides);
+
+  // the sets of job j follow those of job j - 1
+  for (uint32_t j = 0; j < jobs; ++j) {
+    vector<DescriptorBufferInfo> descBuffInfos;
+    for (size_t i = 0; i < b.inBuffs.size(); ++i)
+      descBuffInfos.push_back(DescriptorBufferInfo(
+          b.inBuffs.at(i), j * b.inStrides.at(i), this->insizes.at(i)));
+    for (size_t i = 0; i < b.outBuffs.size(); ++i)
+      descBuffInfos.push_back(DescriptorBufferInfo(
+          b.outBuffs.at(i), j * b.outStrides.at(i), this->outsizes.at(i)));
+    if (this->addressMode) {
+      for (const DescriptorBufferInfo &info : descBuffInfos)
+        b.addrs.push_back(this->bufferAddress(info.buffer) + info.offset);
+      continue;
+    }
+    vector<DescriptorSet> descSets = this->descs.get(descBuffInfos);
+    b.descSets.insert(b.descSets.end(), descSets.begin(), descSets.end());
   }
+
+  b.cmdPool = this->dev.createCommandPool(
+      CommandPoolCreateInfo(CommandPoolCreateFlags(), this->queueFamIndex));
+  b.cmdBuff = this->dev
+                  .allocateCommandBuffers(CommandBufferAllocateInfo(
+                      b.cmdPool, CommandBufferLevel::ePrimary, 1))
+                  .front();
+  b.capacity = jobs;
+}
+
+// free everything createBatch made
+void stdEng::destroyBatch(batchRes &b) {
+  if (!b.capacity)
+    return;
+  this->dev.destroyCommandPool(b.cmdPool);
+  for (Buffer buff : b.inBuffs) {
+    this->descs.evict(buff);
+    this->dev.destroyBuffer(buff);
+  }
+  for (Buffer buff : b.outBuffs) {
+    this->descs.evict(buff);
+    this->dev.destroyBuffer(buff);
+  }
+  for (memAlloc &alloc : b.inAllocs)
+    this->arena.free(alloc);
+  for (memAlloc &alloc : b.outAllocs)
+    this->arena.free(alloc);
+  b = batchRes();
+}
+
+/* Run the kernel once per job with one command buffer, one submit and one
+ * fence for the whole batch, instead of one submit per job. Every job gets
+ * its own descriptor sets, the buffers are kept for the next batches and
+ * only grow.
+ *
+ * @param inputs inputs[j][i] points to input i of job j, insizes[i] bytes as
+ * given with setInputs
+ * @param outputs outputs[j][o] receives output o of job j, outsizes[o] bytes
+ * @return how long the batch took and the jobs per second
+ */
+batchStats stdEng::runBatch(const vector<vector<const void *>> &inputs,
+                            const vector<vector<void *>> &outputs) {
+  if (!this->built)
+    this->build();
+  if (inputs.empty() || inputs.size() != outputs.size()) {
+    cout << "Batch needs one output set per input set!" << endl;
+    delete this;
+    exit(EXIT_FAILURE);
+  }
+  uint32_t jobs = uint32_t(inputs.size());
+  if (jobs > this->batch.capacity) {
+    lock_guard<mutex> lock(this->arenaMutex);
+    this->createBatch(this->batch, jobs);
+  }
+  batchRes &b = this->batch;
+
+  auto start = chrono::steady_clock::now();
+  for (uint32_t j = 0; j < jobs; ++j)
+    for (size_t i = 0; i < b.inAllocs.size() && i < inputs.at(j).size(); ++i)
+      memcpy(static_cast<char *>(b.inAllocs.at(i).mapped) +
+                 j * b.inStrides.at(i),
+             inputs.at(j).at(i), this->insizes.at(i));
+
+  uint32_t setCount = uint32_t(this->bindings.size());
+  size_t addrCount = this->insizes.size() + this->outsizes.size();
+  this->dev.resetCommandPool(b.cmdPool);
+  b.cmdBuff.begin(
+      CommandBufferBeginInfo(CommandBufferUsageFlagBits::eOneTimeSubmit));
+  this->pipe = this->pipelineVariant();
+  uint32_t groups[3];
+  this->groupCount(groups);
+  b.cmdBuff.bindPipeline(PipelineBindPoint::eCompute, this->pipe);
+  // the jobs are independent, no barrier between them
+  for (uint32_t j = 0; j < jobs; ++j) {
+    this->bindBuffers(b.cmdBuff, b.descSets.data() + j * setCount,
+                      b.addrs.data() + j * addrCount);
+    b.cmdBuff.dispatch(groups[0], groups[1], groups[2]);
+  }
+  b.cmdBuff.pipelineBarrier(
+      PipelineStageFlagBits::eComputeShader, PipelineStageFlagBits::eHost, {},
+      MemoryBarrier(AccessFlagBits::eShaderWrite, AccessFlagBits::eHostRead),
+      nullptr, nullptr);
+  b.cmdBuff.end();
+
+  Fence fence = this->fences.acquire();
+  this->ctx->submits.submit(this->queue,
+                       SubmitInfo(0, nullptr, nullptr, 1, &b.cmdBuff), fence);
+  this->waitFenceRes = this->dev.waitForFences({fence}, true, uint64_t(-1));
+  this->fences.release(fence);
+
+  for (size_t o = 0; o < b.outAllocs.size(); ++o) {
+    const memAlloc &alloc = b.outAllocs.at(o);
+    if (!b.outCoherent)
+      this->dev.invalidateMappedMemoryRanges(
+          MappedMemoryRange(alloc.mem, alloc.offset, alloc.size));
+    for (uint32_t j = 0; j < jobs; ++j)
+      if (o < outputs.at(j).size())
+        memcpy(outputs.at(j).at(o),
+               static_cast<const char *>(alloc.mapped) + j * b.outStrides.at(o),
+               this->outsizes.at(o));
+  }
+
+  batchStats stats;
+  stats.jobs = jobs;
+  stats.nanoseconds = chrono::duration_cast<chrono::nanoseconds>(
+                          chrono::steady_clock::now() - start)
+                          .count();
+  if (stats.nanoseconds)
+    stats.jobsPerSec = jobs * 1e9 / stats.nanoseconds;
+  return stats;
+}
+
+/* The lane of the calling thread, made on its first runConcurrent. Only that
+ * takes the lock on the concurrent path, the memory arena and the lane list
+ * are shared with the rest of the engine.
+ */
+stdEng::lane &stdEng::threadLane() {
+  thread_local map<uint64_t, lane *> threadLanes;
+  auto found = threadLanes.find(this->engineId);
+  if (found != threadLanes.end())
+    return *found->second;
+
+  lock_guard<mutex> lock(this->arenaMutex);
+  lane *l = new lane;
+  this->createBatch(l->res, 1);
+  l->secondary = this->dev
+                     .allocateCommandBuffers(CommandBufferAllocateInfo(
+                         l->res.cmdPool, CommandBufferLevel::eSecondary, 1))
+                     .front();
+  l->fence = this->dev.createFence(FenceCreateInfo());
+  l->queueI = uint32_t(this->lanes.size() % this->queues.size());
+  this->lanes.push_back(l);
+  threadLanes[this->engineId] = l;
+  return *l;
+}
+
+/* Record the dispatch of lane l into its secondary command buffer and the
+ * primary that runs it. Both are kept and submitted again as they are until
+ * the pipeline, the workgroup count or the push constants change.
+ */
+void stdEng::recordLane(lane &l, const uint32_t groups[3]) {
+  this->dev.resetCommandPool(l.res.cmdPool);
+  CommandBufferInheritanceInfo inheritInfo;
+  l.secondary.begin(CommandBufferBeginInfo(CommandBufferUsageFlags(),
+                                           &inheritInfo));
+  l.secondary.bindPipeline(PipelineBindPoint::eCompute, this->pipe);
+  this->bindBuffers(l.secondary, l.res.descSets.data(), l.res.addrs.data());
+  l.secondary.dispatch(groups[0], groups[1], groups[2]);
+  l.secondary.end();
+
+  l.res.cmdBuff.begin(CommandBufferBeginInfo());
+  l.res.cmdBuff.executeCommands(l.secondary);
+  l.res.cmdBuff.pipelineBarrier(
+      PipelineStageFlagBits::eComputeShader, PipelineStageFlagBits::eHost, {},
+      MemoryBarrier(AccessFlagBits::eShaderWrite, AccessFlagBits::eHostRead),
+      nullptr, nullptr);
+  l.res.cmdBuff.end();
+
+  l.pipe = this->pipe;
+  copy(groups, groups + 3, l.groups);
+  l.pushData = this->pushData;
+}
+
+/* Run the kernel once and wait, safe to call from many threads at once.
+ * Every thread has its own host visible buffers, descriptor sets, command
+ * pool and fence, and records its own command buffers, so threads only meet
+ * in the submit list. The kernel, its constants and the sizes must not change
+ * while a call is running, build() must be done before.
+ *
+ * @param inputs inputs[i] points to insizes[i] bytes of input i
+ * @param outputs outputs[o] receives outsizes[o] bytes of output o
+ */
+void stdEng::runConcurrent(const vector<const void *> &inputs,
+                           const vector<void *> &outputs) {
+  if (!this->built) {
+    cout << "Engine not built yet!" << endl;
+    delete this;
+    exit(EXIT_FAILURE);
+  }
+  lane &l = this->threadLane();
+  for (size_t i = 0; i < l.res.inAllocs.size() && i < inputs.size(); ++i)
+    memcpy(l.res.inAllocs.at(i).mapped, inputs.at(i), this->insizes.at(i));
+
+  uint32_t groups[3];
+  this->groupCount(groups);
+  if (l.pipe != this->pipe || !equal(groups, groups + 3, l.groups) ||
+      l.pushData != this->pushData)
+    this->recordLane(l, groups);
+
+  this->ctx->submits.submit(this->queues.at(l.queueI),
+                       SubmitInfo(0, nullptr, nullptr, 1, &l.res.cmdBuff),
+                       l.fence);
+  if (this->dev.waitForFences({l.fence}, true, uint64_t(-1)) !=
+      Result::eSuccess) {
+    cout << "Waiting for a concurrent run failed!" << endl;
+    delete this;
+    exit(EXIT_FAILURE);
+  }
+  this->dev.resetFences({l.fence});
+
+  for (size_t o = 0; o < l.res.outAllocs.size() && o < outputs.size(); ++o) {
+    const memAlloc &alloc = l.res.outAllocs.at(o);
+    if (!l.res.outCoherent)
+      this->dev.invalidateMappedMemoryRanges(
+          MappedMemoryRange(alloc.mem, alloc.offset, alloc.size));
+    memcpy(outputs.at(o), alloc.mapped, this->outsizes.at(o));
+  }
+}
+
+// threads that called runConcurrent on this engine so far
+uint32_t stdEng::getLaneCount() {
+  lock_guard<mutex> lock(this->arenaMutex);
+  return uint32_t(this->lanes.size());
 }
 
+/* host address of output i of a submission, invalidated when needed
+ *
+ * @param frameI The frame the submission used
+ * @param serial The submission, waited on when it is still in flight
+ */
+const void *stdEng::outputData(uint32_t frameI, uint64_t serial, size_t i) {
+  if (!this->built || i >= this->outsizes.size()) {
+    cout << "No output memory has been set!" << endl;
+    delete this;
+    exit(EXIT_FAILURE);
+  }
+  frame &f = this->frames.at(frameI);
+  if (f.serial != serial) {
+    cout << "Outputs of submission " << serial
+         << " were overwritten by a newer one!" << endl;
+    delete this;
+    exit(EXIT_FAILURE);
+  }
+  this->waitFrame(frameI, uint64_t(-1));
+  if (this->deviceLocal)
+    return this->staging.data(f.outStageOffsets.at(i));
+  const memAlloc &alloc = f.outAllocs.at(i);
+  if (!this->outCoherent)
+    this->dev.invalidateMappedMemoryRanges(
+        MappedMemoryRange(alloc.mem, alloc.offset, alloc.size));
+  return alloc.mapped;
+}
+
+/* Copy output i of the last dispatch into memory of the caller
+ *
+ * @param i The index of the output
+ * @param dst Where to copy to
+ * @param size The number of bytes to copy, at most the output size
+ */
+void stdEng::readOutput(size_t i, void *dst, size_t size) {
+  const void *src = this->outputData(
+      this->lastFrame, this->frames.at(this->lastFrame).serial, i);
+  memcpy(dst, src, min(size, this->outsizes.at(i)));
+}
+
+// Same as above for the outputs of submission s, it waits for s first
+void stdEng::readOutput(const submission &s, size_t i, void *dst,
+                        size_t size) {
+  const void *src = this->outputData(s.frame, s.serial, i);
+  memcpy(dst, src, min(size, this->outsizes.at(i)));
+}
+
+/* Copy every output of the last dispatch into the vectors given with
+ * setOutputs and return them
+ */
 vector<vector<void*>> stdEng::mapOutputs(){
-  if (this->outMems.empty() || this->outputs.empty()) {
-    if (this->outMems.empty())
+  if (this->frames.empty() || this->outputs.empty()) {
+    if (this->frames.empty())
       cout << "No output memory has been set!" << endl;
     if (this->outputs.empty())
       cout << "No output data has been set!" << endl;
     delete this;
     exit(EXIT_FAILURE);
   }
-  for (size_t i = 0; i < this->outputs.size(); ++i) {
-    void *outPtr =
-        this->dev.mapMemory(this->outMems.at(i), 0, this->outsizes.at(i));
-    memcpy(outPtr, this->outputs.at(i).data(), this->outsizes.at(i));
-    this->dev.unmapMemory(this->outMems.at(i));
-  }
+  for (size_t i = 0; i < this->outputs.size(); ++i)
+    this->readOutput(i, this->outputs.at(i).data(),
+                     this->outputs.at(i).size() * sizeof(void *));
   return this->outputs;
 }
 
+/* Use caller owned memory as input i of the frame the next submission uses,
+ * the gpu reads it in place and nothing is copied. With several frames in
+ * flight call it once per frame, each with its own memory.
+ * Needs VK_EXT_external_memory_host.
+ *
+ * @param i The index of the input
+ * @param hostPtr Aligned to minImportedHostPointerAlignment of the device. The
+ * allocation behind it must cover the input size rounded up to that alignment
+ * and outlive the engine.
+ * @return false when the device can not import it, the input is unchanged
+ */
+bool stdEng::importInput(size_t i, void *hostPtr) {
+  if (!this->built || !this->hostImport || i >= this->insizes.size() ||
+      reinterpret_cast<uintptr_t>(hostPtr) % this->hostImportAlign)
+    return false;
+  ExternalMemoryHandleTypeFlagBits handleType =
+      ExternalMemoryHandleTypeFlagBits::eHostAllocationEXT;
+  MemoryHostPointerPropertiesEXT hostProps =
+      this->dev.getMemoryHostPointerPropertiesEXT(handleType, hostPtr,
+                                                  this->dld);
+  ExternalMemoryBufferCreateInfo extBuffInfo(handleType);
+  BufferCreateInfo buffInfo = this->inBuffInfos.at(i);
+  buffInfo.pNext = &extBuffInfo;
+  Buffer buff = this->dev.createBuffer(buffInfo);
+  MemoryRequirements memReq = this->dev.getBufferMemoryRequirements(buff);
+  uint32_t typeIndex = this->arena.findMemoryType(
+      memReq.memoryTypeBits & hostProps.memoryTypeBits,
+      MemoryPropertyFlagBits::eHostVisible);
+  if (typeIndex == uint32_t(~0)) {
+    this->dev.destroyBuffer(buff);
+    return false;
+  }
+  DeviceSize size = max(memReq.size, buffInfo.size);
+  size = (size + this->hostImportAlign - 1) / this->hostImportAlign *
+         this->hostImportAlign;
+  MemoryAllocateFlagsInfo flagsInfo(MemoryAllocateFlagBits::eDeviceAddress);
+  ImportMemoryHostPointerInfoEXT importInfo(
+      handleType, hostPtr, this->addressMode ? &flagsInfo : nullptr);
+  DeviceMemory mem =
+      this->dev.allocateMemory(MemoryAllocateInfo(size, typeIndex, &importInfo));
+  this->dev.bindBufferMemory(buff, mem, 0);
+
+  frame &f = this->acquireFrame();
+  this->descs.evict(f.inBuffs.at(i));
+  this->dev.destroyBuffer(f.inBuffs.at(i));
+  if (f.inImported.at(i)) {
+    this->dev.freeMemory(f.inImported.at(i));
+  } else {
+    lock_guard<mutex> lock(this->arenaMutex);
+    this->arena.free(f.inAllocs.at(i));
+  }
+  f.inAllocs.at(i) = memAlloc();
+  f.inBuffs.at(i) = buff;
+  f.inImported.at(i) = mem;
+  f.inHostPtrs.at(i) = hostPtr;
+  this->writeDescriptorSets(f);
+  return true;
+}
+
+// block count, used and free bytes and fragmentation of the memory arena
+memArenaStats stdEng::getMemoryStats() {
+  lock_guard<mutex> lock(this->arenaMutex);
+  return this->arena.getStats();
+}
+
+/* Compact the input and output buffers into the lowest memory blocks and free
+ * the blocks left empty. Buffers that move are recreated at the new range and
+ * copied on the gpu, then the descriptor sets are written again.
+ *
+ * @return the number of buffers moved
+ */
+uint32_t stdEng::defragmentMemory() {
+  if (!this->built)
+    return 0;
+  this->waitIdle();
+  lock_guard<mutex> lock(this->arenaMutex);
+
+  frame &first = this->frames.front();
+  this->dev.resetCommandPool(first.cmdPool);
+  first.recorded = false;
+  CommandBuffer cmdBuff = first.cmdBuffs.front();
+  cmdBuff.begin(
+      CommandBufferBeginInfo(CommandBufferUsageFlagBits::eOneTimeSubmit));
+  vector<Buffer> oldBuffs;
+  auto move = [&](const memAlloc &from, const memAlloc &to) {
+    auto moveIn = [&](vector<Buffer> &buffs, vector<BufferCreateInfo> &infos,
+                      vector<memAlloc> &allocs) {
+      for (size_t i = 0; i < allocs.size(); ++i) {
+        if (allocs[i].mem != from.mem || allocs[i].offset != from.offset)
+          continue;
+        Buffer buff = this->dev.createBuffer(infos[i]);
+        this->dev.bindBufferMemory(buff, to.mem, to.offset);
+        cmdBuff.copyBuffer(buffs[i], buff, BufferCopy(0, 0, infos[i].size));
+        oldBuffs.push_back(buffs[i]);
+        buffs[i] = buff;
+        allocs[i] = to;
+        return true;
+      }
+      return false;
+    };
+    // the batch and kernelGraph buffers stay where they are
+    for (frame &f : this->frames)
+      if (moveIn(f.inBuffs, this->inBuffInfos, f.inAllocs) ||
+          moveIn(f.outBuffs, this->outBuffInfos, f.outAllocs))
+        return true;
+    return false;
+  };
+  uint32_t moved = this->arena.defragment(move);
+  cmdBuff.end();
+
+  if (moved) {
+    Fence fence = this->fences.acquire();
+    this->ctx->submits.submit(this->queue,
+                         SubmitInfo(0, nullptr, nullptr, 1, &cmdBuff), fence);
+    this->waitFenceRes = this->dev.waitForFences({fence}, true, uint64_t(-1));
+    this->fences.release(fence);
+    for (Buffer buff : oldBuffs) {
+      this->descs.evict(buff);
+      this->dev.destroyBuffer(buff);
+    }
+    for (frame &f : this->frames)
+      this->writeDescriptorSets(f);
+  }
+  this->arena.trim();
+  this->descs.trim();
+  return moved;
+}
+
+// lookups, hit rate and write time of the descriptor cache
+descCacheStats stdEng::getDescriptorStats() { return this->descs.getStats(); }
+
 // destructor
 stdEng::~stdEng() {
-  if (!(this->debugMode == DebugMode::NO))
-    cout << "Destroying fence" << endl;
-  this->dev.destroyFence(this->fence);
+  traceScope scope("~stdEng");
+  // an engine that never got to its device holds nothing but the context
+  if (!this->dev) {
+    this->ctx->release();
+    return;
+  }
+  tracer::instant("destroy fences");
+  this->ctx->submits.flush();
+  this->waitIdle();
+  this->fences.destroy();
 
-  if (!(this->debugMode == DebugMode::NO))
-    cout << "Reset CommandPool" << endl;
-  this->dev.resetCommandPool(this->cmdPool);
+  tracer::instant("reset command pools");
+  for (frame &f : this->frames)
+    this->dev.resetCommandPool(f.cmdPool);
 
-  if (!(this->debugMode == DebugMode::NO))
-    cout << "Destroying Descriptor Set Layout" << endl;
-  this->dev.destroyDescriptorSetLayout(this->descSetLay);
+  tracer::instant("destroy pipelines");
+  for (auto &variant : this->variants)
+    this->dev.destroyPipeline(variant.second);
+  this->pipeCache.destroy();
 
-  if (!(this->debugMode == DebugMode::NO))
-    cout << "Destroying PipelineLayout" << endl;
-  this->dev.destroyPipelineLayout(this->pipeLay);
+  tracer::instant("destroy descriptor set layouts");
+  for (DescriptorSetLayout descSetLay : this->descSetLays)
+    this->dev.destroyDescriptorSetLayout(descSetLay);
 
-  if (!(this->debugMode == DebugMode::NO))
-    cout << "Destroying Shader Moduld" << endl;
-  this->dev.destroyShaderModule(this->shadMod);
+  tracer::instant("destroy pipeline layout");
+  this->dev.destroyPipelineLayout(this->pipeLay);
 
-  if (!(this->debugMode == DebugMode::NO))
-    cout << "Destroying Descriptor Pool" << endl;
-  this->dev.destroyDescriptorPool(this->descPool);
+  tracer::instant("destroy shader module");
+  shaderCache::release(this->dev, this->shadMod);
 
-  if (!(this->debugMode == DebugMode::NO))
-    cout << "Destroying CommandPool" << endl;
-  this->dev.destroyCommandPool(this->cmdPool);
+  tracer::instant("destroy descriptors");
+  this->destroyBatch(this->batch);
+  for (lane *l : this->lanes) {
+    this->destroyBatch(l->res);
+    this->dev.destroyFence(l->fence);
+    delete l;
+  }
+  this->descs.destroy();
 
-  if (!(this->debugMode == DebugMode::NO))
-    cout << "Free Memory input and output" << endl;
-  for (DeviceMemory mem : this->inMems)
-    this->dev.freeMemory(mem);
-  for (DeviceMemory mem : this->outMems)
-    this->dev.freeMemory(mem);
+  tracer::instant("destroy command pools");
+  for (frame &f : this->frames) {
+    this->dev.destroyCommandPool(f.cmdPool);
+    if (f.queryPool)
+      this->dev.destroyQueryPool(f.queryPool);
+    if (f.transferCmdPool) {
+      this->dev.destroyCommandPool(f.transferCmdPool);
+      this->dev.destroySemaphore(f.uploadSem);
+      this->dev.destroySemaphore(f.computeSem);
+    }
+  }
 
-  if (!(this->debugMode == DebugMode::NO))
-    cout << "Destroying buffer" << endl;
-  for (Buffer buff : this->inBuffs)
-    this->dev.destroyBuffer(buff);
-  for (Buffer buff : this->outBuffs)
-    this->dev.destroyBuffer(buff);
+  tracer::instant("destroy buffers");
+  for (frame &f : this->frames) {
+    for (Buffer buff : f.inBuffs)
+      this->dev.destroyBuffer(buff);
+    for (Buffer buff : f.outBuffs)
+      this->dev.destroyBuffer(buff);
+  }
 
-  if (!(this->debugMode == DebugMode::NO))
-    cout << "Destroying Device" << endl;
-  this->dev.destroy();
+  tracer::instant("free memory");
+  for (frame &f : this->frames)
+    for (DeviceMemory mem : f.inImported)
+      if (mem)
+        this->dev.freeMemory(mem);
+  this->staging.destroy();
+  this->arena.destroy();
 
-  if (!(this->debugMode == DebugMode::NO))
-    cout << "Destroying Instance" << endl;
-  this->inst.destroy();
+  // the device and instance go with the last engine on the context
+  this->ctx->release();
 }
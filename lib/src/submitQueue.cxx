@@ -0,0 +1,125 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3.0
+// for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <cstdlib>
+#include <iostream>
+#include <submitQueue.hxx>
+#include <thread>
+
+using namespace std;
+using namespace vkmincomp;
+
+submitQueue::submitQueue() : head(&this->stub), tail(&this->stub) {}
+
+// any thread, wait free: one exchange and one store
+void submitQueue::push(node *n) {
+  n->next.store(nullptr, memory_order_relaxed);
+  node *prev = this->head.exchange(n, memory_order_acq_rel);
+  prev->next.store(n, memory_order_release);
+}
+
+/* consumer only. nullptr when the list is empty, or when the next node is
+ * still being linked by a producer that swapped head already
+ */
+submitQueue::node *submitQueue::pop() {
+  node *t = this->tail;
+  node *next = t->next.load(memory_order_acquire);
+  if (t == &this->stub) {
+    if (!next)
+      return nullptr;
+    this->tail = next;
+    t = next;
+    next = next->next.load(memory_order_acquire);
+  }
+  if (next) {
+    this->tail = next;
+    return t;
+  }
+  if (t != this->head.load(memory_order_acquire))
+    return nullptr;
+  // t is the last node, put the stub behind it so t can leave
+  this->push(&this->stub);
+  next = t->next.load(memory_order_acquire);
+  if (next) {
+    this->tail = next;
+    return t;
+  }
+  return nullptr;
+}
+
+/* Become the consumer if nobody is and submit the nodes counted in pending
+ * when the pass began, fewer when one of them is still being linked. An
+ * exception of the driver is caught, so draining is always cleared, and
+ * goes to the owner of the node through its result.
+ */
+void submitQueue::drainPass() {
+  if (this->draining.exchange(true))
+    return;
+  for (uint32_t budget = this->pending.load(); budget; --budget) {
+    node *n = this->pop();
+    if (!n)
+      break;
+    Result result = Result::eSuccess;
+    try {
+      n->queue.submit(SubmitInfo(n->waitSems, n->waitStages, n->cmdBuffs,
+                                 n->signalSems),
+                      n->fence);
+    } catch (SystemError &e) {
+      result = Result(e.code().value());
+    }
+    n->result = result;
+    this->pending.fetch_sub(1);
+    this->submitCount.fetch_add(1, memory_order_relaxed);
+    // the owner may return and free n right after this store
+    n->done.store(true, memory_order_release);
+  }
+  this->draining.store(false);
+}
+
+/* Thread safe vkQueueSubmit of one SubmitInfo, returns once it reached the
+ * driver. A failed submit ends the process like the other errors of the
+ * engine, a fence that never signals would leave its waiter hanging.
+ *
+ * @param queue Any queue of the device
+ * @param info Its arrays are copied, they may go away after the call
+ * @param fence Signaled when the work is done, may be null
+ */
+void submitQueue::submit(Queue queue, const SubmitInfo &info, Fence fence) {
+  node n;
+  n.queue = queue;
+  n.waitSems.assign(info.pWaitSemaphores,
+                    info.pWaitSemaphores + info.waitSemaphoreCount);
+  n.waitStages.assign(info.pWaitDstStageMask,
+                      info.pWaitDstStageMask + info.waitSemaphoreCount);
+  n.cmdBuffs.assign(info.pCommandBuffers,
+                    info.pCommandBuffers + info.commandBufferCount);
+  n.signalSems.assign(info.pSignalSemaphores,
+                      info.pSignalSemaphores + info.signalSemaphoreCount);
+  n.fence = fence;
+  this->pending.fetch_add(1);
+  this->push(&n);
+  while (!n.done.load(memory_order_acquire)) {
+    this->drainPass();
+    if (!n.done.load(memory_order_acquire))
+      this_thread::yield();
+  }
+  if (n.result != Result::eSuccess) {
+    cout << "Failed to submit to the queue: " << to_string(n.result) << endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+// wait until everything pushed so far reached the driver
+void submitQueue::flush() {
+  while (this->pending.load()) {
+    this->drainPass();
+    this_thread::yield();
+  }
+}
+
+// vkQueueSubmit calls made so far
+uint64_t submitQueue::getSubmitCount() { return this->submitCount.load(); }
+
+submitQueue::~submitQueue() {
+  this->flush();
+}
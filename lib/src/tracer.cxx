@@ -0,0 +1,206 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3.0
+// for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <tracer.hxx>
+
+using namespace std;
+using namespace vkmincomp;
+
+atomic<bool> tracer::on{false};
+atomic<tracer::ring *> tracer::rings{nullptr};
+atomic<uint32_t> tracer::nextTid{1};
+atomic<uint32_t> tracer::capacity{1u << 16};
+chrono::steady_clock::time_point tracer::epoch = chrono::steady_clock::now();
+
+/* Start or stop recording. The rings made before keep their size and their
+ * events.
+ *
+ * @param capacity Events per thread ring, rounded up to a power of two. Only
+ * rings made after the call get it.
+ */
+void tracer::enable(bool enable, uint32_t capacity) {
+  uint32_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  tracer::capacity.store(size);
+  on.store(enable);
+}
+
+/* The ring of the calling thread, made on its first event and put on the
+ * list with a compare and swap. Rings live until the process exits.
+ */
+tracer::ring *tracer::threadRing() {
+  thread_local ring *own = nullptr;
+  if (own)
+    return own;
+  // one read, enable() may change it meanwhile
+  uint32_t size = tracer::capacity.load();
+  own = new ring;
+  own->events.resize(size);
+  own->mask = size - 1;
+  own->tid = nextTid.fetch_add(1);
+  ring *head = rings.load();
+  do
+    own->next = head;
+  while (!rings.compare_exchange_weak(head, own));
+  return own;
+}
+
+uint64_t tracer::now() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+             chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+// only the owning thread writes its ring, the release publishes the event
+void tracer::record(const char *name, char type, uint64_t value, uint64_t ns) {
+  ring *r = threadRing();
+  uint64_t i = r->written.load(memory_order_relaxed);
+  r->events[i & r->mask] = {ns, name, value, type};
+  r->written.store(i + 1, memory_order_release);
+}
+
+void tracer::begin(const char *name) {
+  if (enabled())
+    record(name, 'B', 0, now());
+}
+
+void tracer::end(const char *name) {
+  if (enabled())
+    record(name, 'E', 0, now());
+}
+
+// a step timed by the caller, like the phases of stdEng::build
+void tracer::span(const char *name, chrono::steady_clock::time_point start,
+                  chrono::steady_clock::time_point finish) {
+  if (!enabled())
+    return;
+  record(name, 'X',
+         chrono::duration_cast<chrono::nanoseconds>(finish - start).count(),
+         chrono::duration_cast<chrono::nanoseconds>(start - epoch).count());
+}
+
+// a value over time, a buffer size or a queue depth
+void tracer::counter(const char *name, uint64_t value) {
+  if (enabled())
+    record(name, 'C', value, now());
+}
+
+// a point in time with a value, a Vulkan result or a frame index
+void tracer::instant(const char *name, int64_t value) {
+  if (enabled())
+    record(name, 'i', uint64_t(value), now());
+}
+
+// the events still in the rings with their thread, oldest first
+vector<pair<uint32_t, traceEvent>> tracer::collect() {
+  vector<pair<uint32_t, traceEvent>> all;
+  for (ring *r = rings.load(); r; r = r->next) {
+    uint64_t written = r->written.load(memory_order_acquire);
+    uint64_t first = written > r->events.size() ? written - r->events.size()
+                                                 : 0;
+    for (uint64_t i = first; i < written; ++i)
+      all.push_back({r->tid, r->events[i & r->mask]});
+  }
+  stable_sort(all.begin(), all.end(),
+              [](const pair<uint32_t, traceEvent> &a,
+                 const pair<uint32_t, traceEvent> &b) {
+                return a.second.ns < b.second.ns;
+              });
+  return all;
+}
+
+/* The trace in the Chrome trace event format, for chrome://tracing or
+ * Perfetto
+ *
+ * @return false when the file can not be written
+ */
+bool tracer::writeChromeJson(const char *path) {
+  ofstream out(path);
+  if (!out)
+    return false;
+  out << "{\"traceEvents\":[";
+  bool first = true;
+  for (auto &entry : collect()) {
+    const traceEvent &e = entry.second;
+    string name;
+    for (const char *c = e.name; *c; ++c) {
+      if (*c == '"' || *c == '\\')
+        name += '\\';
+      name += *c;
+    }
+    out << (first ? "" : ",") << "\n{\"name\":\"" << name << "\",\"ph\":\""
+        << e.type << "\",\"pid\":1,\"tid\":" << entry.first
+        << ",\"ts\":" << e.ns / 1000.0;
+    if (e.type == 'X')
+      out << ",\"dur\":" << e.value / 1000.0;
+    else if (e.type == 'C')
+      out << ",\"args\":{\"value\":" << e.value << "}";
+    else if (e.type == 'i')
+      out << ",\"args\":{\"value\":" << int64_t(e.value) << "}";
+    if (e.type == 'i')
+      out << ",\"s\":\"t\"";
+    out << "}";
+    first = false;
+  }
+  out << "\n]}\n";
+  return bool(out);
+}
+
+/* The trace in a compact little endian form on any host: "VKMT", the
+ * version 1, the name count and every name as a uint16 length and its bytes,
+ * then the event count and per event ns (u64), thread (u32), name index
+ * (u32), value (u64, two's complement i64 for 'i') and type (u8)
+ *
+ * @return false when the file can not be written
+ */
+bool tracer::writeBinary(const char *path) {
+  ofstream out(path, ios::binary);
+  if (!out)
+    return false;
+  vector<pair<uint32_t, traceEvent>> all = collect();
+  map<const char *, uint32_t> nameIndex;
+  vector<const char *> names;
+  for (auto &entry : all)
+    if (nameIndex.emplace(entry.second.name, uint32_t(names.size())).second)
+      names.push_back(entry.second.name);
+  // the low byte first, whatever the byte order of the host
+  auto put = [&](uint64_t value, size_t size) {
+    char bytes[8];
+    for (size_t i = 0; i < size; ++i)
+      bytes[i] = char((value >> (8 * i)) & 0xff);
+    out.write(bytes, size);
+  };
+  uint32_t version = 1, nameCount = uint32_t(names.size());
+  out.write("VKMT", 4);
+  put(version, sizeof(version));
+  put(nameCount, sizeof(nameCount));
+  for (const char *name : names) {
+    uint16_t len = uint16_t(min<size_t>(char_traits<char>::length(name),
+                                        UINT16_MAX));
+    put(len, sizeof(len));
+    out.write(name, len);
+  }
+  uint64_t eventCount = all.size();
+  put(eventCount, sizeof(eventCount));
+  for (auto &entry : all) {
+    const traceEvent &e = entry.second;
+    uint32_t index = nameIndex.at(e.name);
+    put(e.ns, sizeof(e.ns));
+    put(entry.first, sizeof(entry.first));
+    put(index, sizeof(index));
+    put(e.value, sizeof(e.value));
+    put(uint8_t(e.type), 1);
+  }
+  return bool(out);
+}
+
+// forget the recorded events, the threads must not be tracing meanwhile
+void tracer::clear() {
+  for (ring *r = rings.load(); r; r = r->next)
+    r->written.store(0);
+}
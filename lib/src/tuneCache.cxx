@@ -0,0 +1,91 @@
+// Copyright 2024 M Reza Dwi Prasetiawan
+// License under GNU GPL v3.0
+// for more information visit https://www.gnu.org/licenses/gpl-3.0.html
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <tuneCache.hxx>
+
+using namespace std;
+using namespace vkmincomp;
+
+// everything left of the colon in a line of the file
+string tuneCache::key(uint64_t kernelHash, const uint32_t elemCount[3]) {
+  ostringstream k;
+  k << hex << setfill('0') << setw(4) << this->physdevProps.vendorID << ' '
+    << setw(4) << this->physdevProps.deviceID << ' ' << setw(8)
+    << this->physdevProps.driverVersion << ' ' << setw(16) << kernelHash
+    << dec << ' ' << elemCount[0] << ' ' << elemCount[1] << ' '
+    << elemCount[2];
+  return k.str();
+}
+
+/* Read the file, a missing file is an empty cache
+ *
+ * @param physdev The device the results are looked up and stored for
+ * @param path The file, created by save()
+ */
+void tuneCache::open(PhysicalDevice physdev, const string &path) {
+  this->path = path;
+  this->physdevProps = physdev.getProperties();
+  this->entries.clear();
+  ifstream file(path);
+  string line;
+  while (getline(file, line)) {
+    size_t colon = line.find(" : ");
+    if (colon == string::npos)
+      continue;
+    tuneEntry entry;
+    istringstream value(line.substr(colon + 3));
+    value >> entry.localSize[0] >> entry.localSize[1] >> entry.localSize[2] >>
+        entry.tile >> entry.gpuTime;
+    if (!value || !entry.localSize[0] || !entry.tile)
+      continue;
+    this->entries[line.substr(0, colon)] = entry;
+  }
+}
+
+// the stored result of the kernel for this device, driver and element count
+bool tuneCache::find(uint64_t kernelHash, const uint32_t elemCount[3],
+                     tuneEntry &entry) {
+  auto found = this->entries.find(this->key(kernelHash, elemCount));
+  if (found == this->entries.end())
+    return false;
+  entry = found->second;
+  return true;
+}
+
+void tuneCache::store(uint64_t kernelHash, const uint32_t elemCount[3],
+                      const tuneEntry &entry) {
+  this->entries[this->key(kernelHash, elemCount)] = entry;
+}
+
+/* Write every entry, the file is written next to the target under a random
+ * temporary name and renamed like the pipeline cache
+ */
+bool tuneCache::save() {
+  if (this->path.empty())
+    return false;
+  error_code ec;
+  filesystem::path parent = filesystem::path(this->path).parent_path();
+  if (!parent.empty())
+    filesystem::create_directories(parent, ec);
+  string tmpPath =
+      this->path + '.' + to_string(random_device{}()) + ".tmp";
+  ofstream file(tmpPath, ios::trunc);
+  for (auto &e : this->entries)
+    file << e.first << " : " << e.second.localSize[0] << ' '
+         << e.second.localSize[1] << ' ' << e.second.localSize[2] << ' '
+         << e.second.tile << ' ' << e.second.gpuTime << '\n';
+  file.close();
+  if (!file || rename(tmpPath.c_str(), this->path.c_str()) != 0) {
+    cout << "Failed to save autotune results " << this->path << endl;
+    remove(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
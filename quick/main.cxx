@@ -20,6 +20,8 @@
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_handles.hpp>
 #define WIDTH 128
+// ukuran workgroup, diberikan ke shader lewat specialization constant 0
+#define LOCAL_SIZE 64
 #define HEIGHT 1
 #define DEPTH 1
 
@@ -162,9 +164,12 @@ int main() {
       dev.createPipelineCache(PipelineCacheCreateInfo());
 
   // akhirnya saat saat membuat pipeline
+  uint32_t localSize = LOCAL_SIZE;
+  SpecializationMapEntry specEntry(0, 0, sizeof(uint32_t));
+  SpecializationInfo specInfo(1, &specEntry, sizeof(uint32_t), &localSize);
   PipelineShaderStageCreateInfo pipeShaderStageInfo(
       PipelineShaderStageCreateFlags(), ShaderStageFlagBits::eCompute,
-      shaderModule, "main");
+      shaderModule, "main", &specInfo);
   ComputePipelineCreateInfo compPipeInfo(PipelineCreateFlags(),
                                          pipeShaderStageInfo, compPipeLayout);
   Pipeline compPipe =
@@ -210,7 +215,8 @@ int main() {
   cmdBuff.bindPipeline(PipelineBindPoint::eCompute, compPipe);
   cmdBuff.bindDescriptorSets(PipelineBindPoint::eCompute, compPipeLayout, 0,
                              {descSet}, {});
-  cmdBuff.dispatch(WIDTH, 1, 1);
+  // jumlah workgroup dari jumlah elemen dan ukuran workgroup
+  cmdBuff.dispatch((WIDTH + LOCAL_SIZE - 1) / LOCAL_SIZE, 1, 1);
   // akhiri
   cmdBuff.end();
 